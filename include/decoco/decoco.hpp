@@ -4,10 +4,16 @@
 #include <span>
 #include <string_view>
 #include <cstdint>
+#include <concepts>
 #include <memory>
 
 namespace Decoco {
 
+// Something that takes output piece by piece, such as a writer to a file or
+// socket. The spans it gets are only valid during the call.
+template <typename F>
+concept Sink = std::invocable<F&, std::span<const uint8_t>>;
+
 class Compressor {
 public:
   enum class Level {
@@ -17,19 +23,58 @@ public:
   };
   std::vector<uint8_t> compress(std::span<const uint8_t> in);
   virtual std::span<uint8_t> compress(std::span<const uint8_t> in, std::span<uint8_t> out) = 0;
+  // Compress in and hand the output to sink as it is made, in pieces of at
+  // most chunkSize bytes, straight from a buffer that the compressor keeps.
+  template <Sink F>
+  void compress(std::span<const uint8_t> in, F&& sink) {
+    std::span<uint8_t> room = buffer();
+    for (std::span<uint8_t> out = compress(in, room);; out = compress({}, room)) {
+      if (!out.empty()) sink(std::span<const uint8_t>(out));
+      if (out.size() != room.size()) return;
+    }
+  }
   std::vector<uint8_t> flush();
   virtual std::span<uint8_t> flush(std::span<uint8_t> out) = 0;
+  template <Sink F>
+  void flush(F&& sink) {
+    std::span<uint8_t> room = buffer();
+    for (std::span<uint8_t> out = flush(room);; out = flush(room)) {
+      if (!out.empty()) sink(std::span<const uint8_t>(out));
+      if (out.size() != room.size()) return;
+    }
+  }
+  // The most that compressInto() can make of size bytes of input.
+  virtual size_t compressBound(size_t size) const = 0;
+  // Compress all of in into out as a complete stream of its own, in a single
+  // call, and return the part of out that was used. Returns an empty span if
+  // out is too small; compressBound(in.size()) bytes are always enough. The
+  // compressor can be used for any number of these calls, but not in the
+  // middle of a stream made with compress() and flush().
+  virtual std::span<uint8_t> compressInto(std::span<const uint8_t> in, std::span<uint8_t> out) = 0;
   virtual ~Compressor() = default;
 protected:
   Compressor(size_t chunkSize) : chunkSize(chunkSize) {}
 private:
+  std::span<uint8_t> buffer();
   size_t chunkSize;
+  std::unique_ptr<uint8_t[]> chunk;
 };
 
 class Decompressor {
 public:
   std::vector<uint8_t> decompress(std::span<const uint8_t> in);
   virtual std::span<uint8_t> decompress(std::span<const uint8_t> in, std::span<uint8_t> out) = 0;
+  // Decompress in and hand the output to sink as it is made, in pieces of at
+  // most outputChunkSize bytes, straight from a buffer that the decompressor
+  // keeps.
+  template <Sink F>
+  void decompress(std::span<const uint8_t> in, F&& sink) {
+    std::span<uint8_t> room = buffer();
+    for (std::span<uint8_t> out = decompress(in, room);; out = decompress({}, room)) {
+      if (!out.empty()) sink(std::span<const uint8_t>(out));
+      if (out.size() != room.size()) return;
+    }
+  }
   virtual ~Decompressor() = default;
   virtual size_t bytesUsed() const = 0;
 protected:
@@ -37,25 +82,45 @@ protected:
   : outputChunkSize(outputChunkSize)
   {}
 private:
+  std::span<uint8_t> buffer();
   size_t outputChunkSize;
+  std::unique_ptr<uint8_t[]> chunk;
 };
 
 std::unique_ptr<Compressor> GzipCompressor(Compressor::Level level = Compressor::Level::Balanced, size_t chunkSize = 16384);
 std::unique_ptr<Compressor> ZlibCompressor(Compressor::Level level = Compressor::Level::Balanced, size_t chunkSize = 16384);
 std::unique_ptr<Compressor> DeflateCompressor(Compressor::Level level = Compressor::Level::Balanced, size_t chunkSize = 16384);
+// Given a number of threads (0 for one per core), the gzip, zlib and deflate
+// compressors cut the input into blocks, compress them on that many threads
+// and join them into one stream. The output does not depend on the number of
+// threads, 1 included, but differs from that of the compressors above.
+std::unique_ptr<Compressor> GzipCompressor(Compressor::Level level, size_t chunkSize, size_t threads);
+std::unique_ptr<Compressor> ZlibCompressor(Compressor::Level level, size_t chunkSize, size_t threads);
+std::unique_ptr<Compressor> DeflateCompressor(Compressor::Level level, size_t chunkSize, size_t threads);
 std::unique_ptr<Compressor> LzmaCompressor(Compressor::Level level = Compressor::Level::Balanced, size_t chunkSize = 16384);
 std::unique_ptr<Compressor> Bzip2Compressor(Compressor::Level level = Compressor::Level::Balanced, size_t chunkSize = 16384);
 std::unique_ptr<Compressor> BrotliCompressor(Compressor::Level level = Compressor::Level::Balanced, size_t chunkSize = 16384);
 std::unique_ptr<Compressor> ZstdCompressor(Compressor::Level level = Compressor::Level::Balanced, size_t chunkSize = 16384);
+// BGZF, the blocked gzip that genomics tools read, on multiple threads if
+// threads is not 1 (0 for one per core). The output does not depend on the
+// number of threads.
+std::unique_ptr<Compressor> BgzfCompressor(Compressor::Level level = Compressor::Level::Balanced, size_t chunkSize = 16384, size_t threads = 1);
 std::unique_ptr<Compressor> FindCompressor(std::string_view name, Compressor::Level level = Compressor::Level::Balanced, size_t chunkSize = 16384);
 
-std::unique_ptr<Decompressor> GzipDecompressor(size_t outputChunkSize = 16384);
+// Gzip data may consist of several members, as concatenating gzip files gives;
+// their output is joined. With threads other than 1 (0 for one per core), the
+// members in each piece of input are inflated side by side.
+std::unique_ptr<Decompressor> GzipDecompressor(size_t outputChunkSize = 16384, size_t threads = 1);
+// Gzip decompression on two threads of its own, for any gzip data: one
+// inflates ahead of the caller, the other verifies the CRC-32s.
+std::unique_ptr<Decompressor> PipelinedGzipDecompressor(size_t outputChunkSize = 16384);
 std::unique_ptr<Decompressor> ZlibDecompressor(size_t outputChunkSize = 16384);
 std::unique_ptr<Decompressor> DeflateDecompressor(size_t outputChunkSize = 16384);
 std::unique_ptr<Decompressor> LzmaDecompressor(size_t outputChunkSize = 16384);
 std::unique_ptr<Decompressor> Bzip2Decompressor(size_t outputChunkSize = 16384);
 std::unique_ptr<Decompressor> BrotliDecompressor(size_t outputChunkSize = 16384);
 std::unique_ptr<Decompressor> ZstdDecompressor(size_t outputChunkSize = 16384);
+std::unique_ptr<Decompressor> BgzfDecompressor(size_t outputChunkSize = 16384, size_t threads = 1);
 std::unique_ptr<Decompressor> FindDecompressor(std::string_view name, size_t outputChunkSize = 16384);
 std::unique_ptr<Decompressor> SniffDecompressor(std::span<uint8_t> file, size_t outputChunkSize = 16384);
 
@@ -64,19 +129,240 @@ std::vector<uint8_t> compress(Decoco::Compressor& c, std::span<const uint8_t> in
 inline std::vector<uint8_t> compress(const std::unique_ptr<Decoco::Compressor>& c, std::span<const uint8_t> in) {
   return compress(*c.get(), in);
 }
+// decompress() allocates its output at once if the data says how large it
+// is, as decompressedSizeHint() finds it, and otherwise grows it as it goes.
 std::vector<uint8_t> decompress(Decoco::Decompressor& c, std::span<const uint8_t> in);
 inline std::vector<uint8_t> decompress(const std::unique_ptr<Decoco::Decompressor>& c, std::span<const uint8_t> in) {
   return decompress(*c.get(), in);
 }
+// The decompressed size that compressed data gives, found without
+// decompressing it, or 0 if it does not give one: the sizes in the trailers of
+// BGZF blocks, or else in the trailer of the last gzip member (which is modulo
+// 4 GiB), the content sizes in the frame headers of zstd, or the indexes of
+// xz. The data is not checked, so corrupt data can give any size.
+uint64_t decompressedSizeHint(std::span<const uint8_t> in);
+
+// Checksums as used by gzip (CRC-32) and zlib (Adler-32). Feed data in with
+// update(); combine() appends the checksum of data that followed, computed
+// separately, without needing that data.
+class Crc32 {
+public:
+  Crc32& update(std::span<const uint8_t> in);
+  Crc32& combine(const Crc32& next);
+  uint32_t value() const { return crc; }
+  uint64_t size() const { return length; }
+private:
+  uint32_t crc = 0;
+  uint64_t length = 0;
+};
+
+class Adler32 {
+public:
+  Adler32& update(std::span<const uint8_t> in);
+  Adler32& combine(const Adler32& next);
+  uint32_t value() const { return adler; }
+  uint64_t size() const { return length; }
+private:
+  uint32_t adler = 1;
+  uint64_t length = 0;
+};
+
+// Checksum of A followed by B, given the checksums of both and the length of B.
+uint32_t crc32_combine(uint32_t crcA, uint32_t crcB, uint64_t lengthB);
+uint32_t adler32_combine(uint32_t adlerA, uint32_t adlerB, uint64_t lengthB);
+
+// Checksum a whole buffer, splitting large ones over the given number of
+// threads (0 for one per core).
+uint32_t crc32(std::span<const uint8_t> in, size_t threads = 1);
+uint32_t adler32(std::span<const uint8_t> in, size_t threads = 1);
+
+// The built-in gzip/zlib/deflate code has CPU-specific variants of its hot
+// loops ("kernels"), chosen at runtime. kernels() reports them; forceKernel()
+// switches a kernel to another variant for comparisons, or back to the
+// default choice with an empty variant. It returns false if the kernel or
+// variant is unknown, or the variant cannot run on this CPU. The environment
+// variable DECOCO_KERNELS does the same at startup, e.g.
+// DECOCO_KERNELS=crc32=c,longest_match=sse2, or DECOCO_KERNELS=c for the
+// portable code everywhere.
+struct Kernel {
+  std::string_view name;
+  std::string_view active;
+  std::vector<std::string_view> supported; // best first
+};
+std::vector<Kernel> kernels();
+bool forceKernel(std::string_view kernel, std::string_view variant);
 
 std::vector<uint8_t> gzip(std::span<const uint8_t> in);
 std::vector<uint8_t> bzip2(std::span<const uint8_t> in);
 std::vector<uint8_t> xzip(std::span<const uint8_t> in);
 
-std::vector<uint8_t> gunzip(std::span<const uint8_t> in);
+// gunzip can decompress large files on multiple threads (0 for one per core).
+// It then inflates the members of a multi-member file side by side, or looks
+// for deflate blocks in later parts of a single member and decodes them before
+// the data they refer back to, which works on any gzip file.
+std::vector<uint8_t> gunzip(std::span<const uint8_t> in, size_t threads = 1);
 std::vector<uint8_t> bunzip2(std::span<const uint8_t> in);
 std::vector<uint8_t> xunzip(std::span<const uint8_t> in);
 
+// Random access into gzip, zlib or raw deflate data. Building an index
+// decompresses the data once and records a checkpoint at a deflate block
+// boundary about every `spacing` bytes of output. Each checkpoint holds its
+// position in both the compressed and the decompressed data, and the 32 KiB of
+// output before it that later matches can refer to. SeekableDecompressor then
+// reads a range by decompressing from the last checkpoint before it, so the
+// cost depends on the spacing rather than on where in the data the range is.
+//
+// Gzip and zlib data are recognised by their headers; anything else is taken
+// to be raw deflate. Only the first member of a multi-member gzip file is
+// indexed, and the index ends early if the data is truncated or corrupt.
+struct DeflateIndex {
+  struct Checkpoint {
+    uint64_t bit;                // position in the compressed data, in bits
+    uint64_t offset;             // position in the decompressed data
+    std::vector<uint8_t> window; // output before offset, raw deflate compressed
+  };
+  std::vector<Checkpoint> checkpoints;
+  uint64_t size = 0;             // decompressed size
+
+  static DeflateIndex build(std::span<const uint8_t> in, size_t spacing = 1 << 20);
+  std::vector<uint8_t> serialize() const;
+  // Returns an index without checkpoints if in is not a serialized index.
+  static DeflateIndex deserialize(std::span<const uint8_t> in);
+};
+
+class SeekableDecompressor {
+public:
+  SeekableDecompressor(std::span<const uint8_t> compressed, DeflateIndex index);
+  ~SeekableDecompressor();
+  // Decompress the data from offset into out, and return the part of out that
+  // was filled. That is shorter only at the end of the data, or if the data
+  // or index are corrupt. Reading on from where the last read ended continues
+  // decompressing instead of going back to a checkpoint.
+  std::span<uint8_t> read(uint64_t offset, std::span<uint8_t> out);
+  std::vector<uint8_t> read(uint64_t offset, size_t length);
+  const DeflateIndex& index() const { return idx; }
+private:
+  struct Stream;
+  std::span<const uint8_t> compressed;
+  DeflateIndex idx;
+  std::unique_ptr<Stream> stream;
+};
+
+// Random access into BGZF data. Its blocks say how large they are, so finding
+// a block takes no decompression, and a BGZF reader only decompresses the one
+// block that it reads from. Positions in the data are virtual offsets, as
+// htslib uses them: the position of a block in the compressed data times 65536
+// plus a position in the output of that block.
+//
+// A BgzfIndex lists where each block after the first starts in the compressed
+// and in the decompressed data, which maps decompressed offsets to blocks. It
+// is built from the block headers and trailers alone, and serializes to the
+// .gzi format of `bgzip --reindex`.
+struct BgzfIndex {
+  struct Block {
+    uint64_t compressed;
+    uint64_t uncompressed;
+  };
+  std::vector<Block> blocks;
+
+  static BgzfIndex build(std::span<const uint8_t> in);
+  std::vector<uint8_t> serialize() const;
+  // Returns an empty index if in is not a .gzi file.
+  static BgzfIndex deserialize(std::span<const uint8_t> in);
+};
+
+class BgzfReader {
+public:
+  // Without an index, one is built the first time seekUncompressed needs it.
+  BgzfReader(std::span<const uint8_t> compressed);
+  BgzfReader(std::span<const uint8_t> compressed, BgzfIndex index);
+  // Move to a virtual offset, as tell() returned it. Returns false if there is
+  // no block there, or the offset is past the end of its output.
+  bool seek(uint64_t virtualOffset);
+  // Move to an offset in the decompressed data.
+  bool seekUncompressed(uint64_t offset);
+  uint64_t tell() const;
+  // Read from the current position on into out, and return the part of out
+  // that was filled. That is shorter only at the end of the data, or at a
+  // block that is corrupt.
+  std::span<uint8_t> read(std::span<uint8_t> out);
+  std::vector<uint8_t> read(size_t length);
+  const BgzfIndex& index() const { return idx; }
+private:
+  bool load(uint64_t pos);
+  std::span<const uint8_t> compressed;
+  BgzfIndex idx;
+  bool indexed = false;
+  uint64_t block = 0, next = 0; // where the current block and the one after it start
+  std::vector<uint8_t> data;    // output of the current block
+  size_t offset = 0;            // read position in data
+};
+
+// ZIP archives, with the built-in deflate. A ZipWriter compresses each entry
+// as a whole, on a pool of threads if threads is not 1 (0 for one per core),
+// and puts the entries in the archive in the order they were added. add()
+// and finish() return the archive piece by piece as entries are done; joined,
+// they are the archive. Deflated entries that do not get smaller are stored.
+// ZIP64 fields are written where sizes, offsets or the number of entries do
+// not fit the original ones. Entries get the earliest time ZIP can hold, so
+// that the archive only depends on what was added.
+class ZipWriter {
+public:
+  enum class Method {
+    Stored,
+    Deflated,
+  };
+  ZipWriter(Compressor::Level level = Compressor::Level::Balanced, size_t threads = 1);
+  ~ZipWriter();
+  std::vector<uint8_t> add(std::string_view name, std::span<const uint8_t> data, Method method = Method::Deflated);
+  // Waits for the entries still being compressed, and returns them with the
+  // central directory that ends the archive.
+  std::vector<uint8_t> finish();
+private:
+  struct Pool;
+  std::unique_ptr<Pool> pool;
+};
+
+// Reads entries from a ZIP archive in memory (mapping the file in works well),
+// by name through its central directory, without looking at other entries.
+// Entries are only decompressed when read, and stored ones can be used where
+// they are. Reading does not change the reader, so any number of threads can
+// read entries from one reader at the same time.
+class ZipReader {
+public:
+  struct Entry {
+    std::string_view name;  // points into the archive
+    uint16_t flags;
+    uint16_t method;        // 0 for stored, 8 for deflated
+    uint32_t crc;
+    uint64_t compressedSize;
+    uint64_t size;
+    uint64_t offset;        // of its local header in the archive
+  };
+  // Without a valid central directory, the reader has no entries.
+  ZipReader(std::span<const uint8_t> archive);
+  ZipReader(ZipReader&&) noexcept;
+  ZipReader& operator=(ZipReader&&) noexcept;
+  ~ZipReader();
+  const std::vector<Entry>& entries() const;
+  // Returns nullptr if there is no entry with that name, or the first one if
+  // there are several.
+  const Entry* find(std::string_view name) const;
+  // The data of the entry as it is in the archive: the contents of a stored
+  // entry, or raw deflate. Empty if its local header is corrupt.
+  std::span<const uint8_t> raw(const Entry& entry) const;
+  // Decompress the entry into out, which must be entry.size bytes. Returns
+  // false if the data is corrupt, does not match its CRC-32, or is encrypted
+  // or compressed with something other than deflate.
+  bool read(const Entry& entry, std::span<uint8_t> out) const;
+  // The contents of the entry, or nothing in the same cases.
+  std::vector<uint8_t> read(const Entry& entry) const;
+private:
+  struct Index;
+  std::span<const uint8_t> archive;
+  std::unique_ptr<Index> index;
+};
+
 }
 
 
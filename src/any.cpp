@@ -1,4 +1,5 @@
 #include <decoco/decoco.hpp>
+#include "size_hint.h"
 #include <memory>
 
 namespace Decoco {
@@ -11,6 +12,7 @@ std::unique_ptr<Compressor> FindCompressor(std::string_view name, Compressor::Le
   if (name == "deflate") return DeflateCompressor(level, chunkSize);
   if (name == "brotli") return BrotliCompressor(level, chunkSize);
   if (name == "zstd") return ZstdCompressor(level, chunkSize);
+  if (name == "bgzf") return BgzfCompressor(level, chunkSize);
   return nullptr;
 }
 
@@ -22,6 +24,7 @@ std::unique_ptr<Decompressor> FindDecompressor(std::string_view name, size_t out
   if (name == "deflate") return DeflateDecompressor(outputChunkSize);
   if (name == "brotli") return BrotliDecompressor(outputChunkSize);
   if (name == "zstd") return ZstdDecompressor(outputChunkSize);
+  if (name == "bgzf") return BgzfDecompressor(outputChunkSize);
   return nullptr;
 }
 
@@ -39,6 +42,13 @@ std::unique_ptr<Decompressor> SniffDecompressor(std::span<uint8_t> file, size_t
   return nullptr;
 }
 
+uint64_t decompressedSizeHint(std::span<const uint8_t> in) {
+  if (in.size() >= 2 && in[0] == 0x1F && in[1] == 0x8B) return GzipSizeHint(in);
+  if (in.size() >= 4 && in[0] == 0xFD && in[1] == 0x37 && in[2] == 0x7A && in[3] == 0x58) return XzSizeHint(in);
+  if (in.size() >= 4 && in[0] == 0x28 && in[1] == 0xB5 && in[2] == 0x2F && in[3] == 0xFD) return ZstdSizeHint(in);
+  return 0;
+}
+
 }
 
 
@@ -0,0 +1,249 @@
+#include <decoco/decoco.hpp>
+#include "zlib/zlib.h"
+#include "bgzf.h"
+#include "parallel_deflate.h"
+#include <assert.h>
+#include <algorithm>
+
+namespace Decoco {
+
+// BGZF (the blocked gzip of the SAM/BAM specification) is a series of gzip
+// members, each with an extra field "BC" that holds the size of the member
+// minus one. That limits a member to 64 KiB, and lets readers step from one
+// member to the next without decompressing anything.
+static constexpr size_t headerSize = 18;
+static constexpr size_t trailerSize = 8;
+static constexpr size_t maxBlockSize = 65536;
+
+const uint8_t bgzfEof[28] = {
+  0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43, 0x02, 0x00,
+  0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static uint32_t get32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+}
+
+static uint64_t get64(const uint8_t* p) {
+  return get32(p) | (uint64_t(get32(p + 4)) << 32);
+}
+
+static void put64(std::vector<uint8_t>& out, uint64_t value) {
+  for (int n = 0; n < 64; n += 8) out.push_back(uint8_t(value >> n));
+}
+
+// Raw deflate of in into out, or false if it does not fit.
+static bool deflateInto(std::span<const uint8_t> in, int level, std::span<uint8_t> out, size_t& used) {
+  Zlib::z_stream strm = {};
+  int ret = deflateInit2(&strm, level, Zlib::Z_DEFLATED, -Zlib::MAX_WBITS, 8, Zlib::Z_DEFAULT_STRATEGY);
+  assert(ret == Zlib::Z_OK);
+  strm.next_in = const_cast<uint8_t*>(in.data());
+  strm.avail_in = in.size();
+  strm.next_out = out.data();
+  strm.avail_out = out.size();
+  ret = deflate(&strm, Zlib::Z_FINISH);
+  used = out.size() - strm.avail_out;
+  deflateEnd(&strm);
+  return ret == Zlib::Z_STREAM_END;
+}
+
+std::vector<uint8_t> BgzfBlock(std::span<const uint8_t> in, int level) {
+  assert(in.size() <= bgzfBlockInput);
+  std::vector<uint8_t> out(maxBlockSize);
+  std::span<uint8_t> room(out.data() + headerSize, maxBlockSize - headerSize - trailerSize);
+  size_t used;
+  // Input that does not compress is stored, which always fits.
+  if (!deflateInto(in, level, room, used)) {
+    bool stored = deflateInto(in, 0, room, used);
+    assert(stored);
+  }
+  size_t size = headerSize + used + trailerSize;
+  std::copy(bgzfEof, bgzfEof + 16, out.begin());
+  out[16] = uint8_t((size - 1) & 0xff);
+  out[17] = uint8_t((size - 1) >> 8);
+  uint8_t* trailer = out.data() + headerSize + used;
+  for (uint32_t v : { Zlib::crc32(0, in.data(), in.size()), uint32_t(in.size()) }) {
+    for (int n = 0; n < 32; n += 8) *trailer++ = uint8_t(v >> n);
+  }
+  out.resize(size);
+  return out;
+}
+
+size_t BgzfBlockSize(std::span<const uint8_t> in, size_t pos) {
+  if (pos > in.size() || in.size() - pos < headerSize) return 0;
+  const uint8_t* h = in.data() + pos;
+  if (h[0] != 0x1f || h[1] != 0x8b || h[2] != Zlib::Z_DEFLATED || !(h[3] & 4)) return 0;
+  // Look for the BC subfield among the others in the extra field.
+  size_t xlen = h[10] | (h[11] << 8);
+  if (in.size() - pos < 12 + xlen) return 0;
+  for (size_t at = 12; at + 4 <= 12 + xlen;) {
+    size_t slen = h[at + 2] | (h[at + 3] << 8);
+    if (h[at] == 'B' && h[at + 1] == 'C' && slen == 2 && at + 6 <= 12 + xlen) {
+      size_t size = (h[at + 4] | (h[at + 5] << 8)) + 1;
+      return size >= 12 + xlen + trailerSize ? size : 0;
+    }
+    at += 4 + slen;
+  }
+  return 0;
+}
+
+static int compressorLevelToZlib(Compressor::Level level) {
+  switch(level) {
+    default: 
+    case Compressor::Level::Balanced: return Zlib::Z_DEFAULT_COMPRESSION;
+    case Compressor::Level::Fast: return Zlib::Z_BEST_SPEED;
+    case Compressor::Level::Small: return Zlib::Z_OPTIMAL_COMPRESSION;
+  }
+}
+
+// Blocks do not refer to each other, so compressing them on threads gives the
+// same output as compressing them in turn.
+std::unique_ptr<Compressor> BgzfCompressor(Compressor::Level level, size_t chunkSize, size_t threads) {
+  return ParallelDeflateCompressor(DeflateWrapper::Bgzf, compressorLevelToZlib(level), chunkSize, threads);
+}
+
+// BGZF is gzip, and the gzip decompressor cuts it into runs of blocks to
+// decompress in parallel by the sizes in their headers.
+std::unique_ptr<Decompressor> BgzfDecompressor(size_t outputChunkSize, size_t threads) {
+  return GzipDecompressor(outputChunkSize, threads);
+}
+
+BgzfIndex BgzfIndex::build(std::span<const uint8_t> in) {
+  BgzfIndex index;
+  uint64_t pos = 0, offset = 0;
+  while (size_t size = BgzfBlockSize(in, pos)) {
+    if (in.size() - pos < size) break;
+    if (pos) index.blocks.push_back({pos, offset});
+    offset += get32(in.data() + pos + size - 4);
+    pos += size;
+  }
+  return index;
+}
+
+// A .gzi file, as bgzip writes it: the number of blocks after the first, then
+// for each of them its offset in the compressed and in the decompressed data,
+// all 64-bit little-endian.
+std::vector<uint8_t> BgzfIndex::serialize() const {
+  std::vector<uint8_t> out;
+  put64(out, blocks.size());
+  for (auto& block : blocks) {
+    put64(out, block.compressed);
+    put64(out, block.uncompressed);
+  }
+  return out;
+}
+
+BgzfIndex BgzfIndex::deserialize(std::span<const uint8_t> in) {
+  BgzfIndex index;
+  if (in.size() < 8) return {};
+  uint64_t count = get64(in.data());
+  if ((in.size() - 8) / 16 != count || (in.size() - 8) % 16 != 0) return {};
+  for (uint64_t n = 0; n < count; n++) {
+    const uint8_t* entry = in.data() + 8 + 16 * n;
+    Block block{get64(entry), get64(entry + 8)};
+    if (!index.blocks.empty() && (block.compressed <= index.blocks.back().compressed || block.uncompressed < index.blocks.back().uncompressed))
+      return {};
+    index.blocks.push_back(block);
+  }
+  return index;
+}
+
+BgzfReader::BgzfReader(std::span<const uint8_t> compressed)
+: compressed(compressed)
+{}
+
+BgzfReader::BgzfReader(std::span<const uint8_t> compressed, BgzfIndex index)
+: compressed(compressed)
+, idx(std::move(index))
+, indexed(true)
+{}
+
+// Decompress the block at pos into data. Returns false, with data empty, if
+// there is no valid block there.
+bool BgzfReader::load(uint64_t pos) {
+  data.clear();
+  offset = 0;
+  block = next = pos;
+  size_t size = BgzfBlockSize(compressed, pos);
+  if (size == 0 || compressed.size() - pos < size) return false;
+  // The trailer is not trusted with an allocation until it is known to be no
+  // more than a block can hold.
+  uint32_t isize = get32(compressed.data() + pos + size - 4);
+  if (isize > maxBlockSize) return false;
+  data.resize(isize);
+  Zlib::z_stream strm = {};
+  int ret = inflateInit2(&strm, 31);
+  assert(ret == Zlib::Z_OK);
+  uint8_t none;
+  strm.next_in = compressed.data() + pos;
+  strm.avail_in = size;
+  strm.next_out = data.empty() ? &none : data.data();
+  strm.avail_out = data.empty() ? 1 : data.size();
+  ret = inflate(&strm, Zlib::Z_FINISH);
+  bool ok = ret == Zlib::Z_STREAM_END && strm.total_out == data.size() && strm.avail_in == 0;
+  inflateEnd(&strm);
+  if (!ok) {
+    data.clear();
+    return false;
+  }
+  next = pos + size;
+  return true;
+}
+
+bool BgzfReader::seek(uint64_t virtualOffset) {
+  if (!load(virtualOffset >> 16)) return false;
+  offset = virtualOffset & 0xffff;
+  if (offset > data.size()) {
+    data.clear();
+    offset = 0;
+    return false;
+  }
+  return true;
+}
+
+bool BgzfReader::seekUncompressed(uint64_t target) {
+  if (!indexed) {
+    idx = BgzfIndex::build(compressed);
+    indexed = true;
+  }
+  // The first block is not in the index; it starts at 0 in both.
+  auto after = std::upper_bound(idx.blocks.begin(), idx.blocks.end(), target,
+                                [](uint64_t target, const BgzfIndex::Block& b) { return target < b.uncompressed; });
+  BgzfIndex::Block start = after == idx.blocks.begin() ? BgzfIndex::Block{0, 0} : *(after - 1);
+  if (!load(start.compressed)) return false;
+  uint64_t skip = target - start.uncompressed;
+  // Blocks without output, and an index that leaves out some, take stepping on.
+  while (skip > data.size() - offset) {
+    skip -= data.size() - offset;
+    if (!load(next)) return false;
+  }
+  offset += skip;
+  return true;
+}
+
+uint64_t BgzfReader::tell() const {
+  return (block << 16) | offset;
+}
+
+std::span<uint8_t> BgzfReader::read(std::span<uint8_t> out) {
+  size_t used = 0;
+  while (used < out.size()) {
+    if (offset == data.size()) {
+      if (next >= compressed.size() || !load(next)) break;
+      continue;
+    }
+    size_t n = std::min(out.size() - used, data.size() - offset);
+    std::copy(data.begin() + offset, data.begin() + offset + n, out.begin() + used);
+    offset += n;
+    used += n;
+  }
+  return out.first(used);
+}
+
+std::vector<uint8_t> BgzfReader::read(size_t length) {
+  std::vector<uint8_t> out(length);
+  out.resize(read(std::span<uint8_t>(out)).size());
+  return out;
+}
+
+}
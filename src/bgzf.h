@@ -0,0 +1,21 @@
+#pragma once
+
+#include <decoco/decoco.hpp>
+
+namespace Decoco {
+
+// BGZF splits its input into blocks of at most this much, which compress to
+// gzip members of at most 64 KiB.
+static constexpr size_t bgzfBlockInput = 0xff00;
+
+// The empty block that ends a BGZF file.
+extern const uint8_t bgzfEof[28];
+
+// Compresses one block of input into a complete BGZF block.
+std::vector<uint8_t> BgzfBlock(std::span<const uint8_t> in, int level);
+
+// Returns the size of the BGZF block at pos in in, as its header gives it, or
+// 0 if there is no complete BGZF header there.
+size_t BgzfBlockSize(std::span<const uint8_t> in, size_t pos);
+
+}
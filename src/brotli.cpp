@@ -16,6 +16,7 @@ struct BrotliCompressorS : Compressor {
   }
   BrotliCompressorS(Compressor::Level level, size_t chunkSize)
   : Compressor(chunkSize)
+  , quality(compressorLevelToBrotli(level))
   , indata(nullptr)
   , insize(0)
   {
@@ -23,7 +24,7 @@ struct BrotliCompressorS : Compressor {
             +[](void*, size_t count) { return malloc(count); },
             +[](void*, void* ptr) { return free(ptr); },
             nullptr);
-    BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, compressorLevelToBrotli(level));
+    BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, quality);
   }
   std::span<uint8_t> compress(std::span<const uint8_t> in, std::span<uint8_t> out) override {
     if (not in.empty()) {
@@ -32,22 +33,29 @@ struct BrotliCompressorS : Compressor {
     }
     size_t outsize = out.size();
     uint8_t* outdata = out.data();
-    size_t totalout = 0;
-    bool ok = BrotliEncoderCompressStream(state, BROTLI_OPERATION_PROCESS, &insize, &indata, &outsize, &outdata, &totalout);
+    bool ok = BrotliEncoderCompressStream(state, BROTLI_OPERATION_PROCESS, &insize, &indata, &outsize, &outdata, nullptr);
     assert(ok);
-    return out.subspan(0, totalout);
+    return out.subspan(0, out.size() - outsize);
   }
   std::span<uint8_t> flush(std::span<uint8_t> out) override {
     size_t outsize = out.size();
     uint8_t* outdata = out.data();
-    size_t totalout = 0;
-    bool ok = BrotliEncoderCompressStream(state, BROTLI_OPERATION_FINISH, &insize, &indata, &outsize, &outdata, &totalout);
+    bool ok = BrotliEncoderCompressStream(state, BROTLI_OPERATION_FINISH, &insize, &indata, &outsize, &outdata, nullptr);
     assert(ok);
-    return out.subspan(0, totalout);
+    return out.subspan(0, out.size() - outsize);
+  }
+  size_t compressBound(size_t size) const override {
+    return BrotliEncoderMaxCompressedSize(size);
+  }
+  std::span<uint8_t> compressInto(std::span<const uint8_t> in, std::span<uint8_t> out) override {
+    size_t outsize = out.size();
+    if (!BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, BROTLI_DEFAULT_MODE, in.size(), in.data(), &outsize, out.data())) return {};
+    return out.subspan(0, outsize);
   }
   ~BrotliCompressorS() {
     BrotliEncoderDestroyInstance(state);
   }
+  int quality;
   BrotliEncoderState* state;
   const uint8_t* indata;
   size_t insize;
@@ -77,16 +85,15 @@ struct BrotliDecompressorS : Decompressor {
       }
     }
 
-    size_t totalout = 0;
     size_t outsize = out.size();
     uint8_t* outdata = out.data();
     in_used += insize;
-    BrotliDecoderResult res = BrotliDecoderDecompressStream(state, &insize, &indata, &outsize, &outdata, &totalout);
+    BrotliDecoderResult res = BrotliDecoderDecompressStream(state, &insize, &indata, &outsize, &outdata, nullptr);
     in_used -= insize;
     if (res == BROTLI_DECODER_RESULT_ERROR) {
       throw std::runtime_error("Decoding failed");
     }
-    return out.subspan(0, totalout);
+    return out.subspan(0, out.size() - outsize);
   }
   ~BrotliDecompressorS() {
     BrotliDecoderDestroyInstance(state);
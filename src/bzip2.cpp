@@ -1,6 +1,8 @@
 #include <decoco/decoco.hpp>
 #include <bzlib.h>
 #include <assert.h>
+#include <limits.h>
+#include <algorithm>
 
 namespace Decoco {
 
@@ -15,9 +17,10 @@ struct Bzip2CompressorS : Compressor {
   }
   Bzip2CompressorS(Compressor::Level level, size_t chunkSize)
   : Compressor(chunkSize)
+  , blockSize(compressorLevelToBZlib(level))
   , strm()
   {
-    int ret = BZ2_bzCompressInit(&strm, compressorLevelToBZlib(level), 0, 30);
+    int ret = BZ2_bzCompressInit(&strm, blockSize, 0, 30);
     assert(ret == BZ_OK);
   }
   std::span<uint8_t> compress(std::span<const uint8_t> in, std::span<uint8_t> out) override {
@@ -40,9 +43,47 @@ struct Bzip2CompressorS : Compressor {
     assert(ret >= 0);
     return out.subspan(0, (uint32_t)out.size() - strm.avail_out);
   }
+  // What the bzip2 manual asks to allocate for BZ2_bzBuffToBuffCompress.
+  size_t compressBound(size_t size) const override {
+    return size + size / 100 + 600;
+  }
+  std::span<uint8_t> compressInto(std::span<const uint8_t> in, std::span<uint8_t> out) override {
+    // No stream is empty, and libbzip2 takes a missing buffer for an error.
+    if (out.empty()) return {};
+    if (in.size() > UINT_MAX) return compressLarge(in, out);
+    unsigned int used = (unsigned int)std::min<size_t>(out.size(), UINT_MAX);
+    int ret = BZ2_bzBuffToBuffCompress(reinterpret_cast<char*>(out.data()), &used, const_cast<char*>(reinterpret_cast<const char*>(in.data())), (unsigned int)in.size(), blockSize, 0, 30);
+    if (ret == BZ_OUTBUFF_FULL) return {};
+    assert(ret == BZ_OK);
+    return out.subspan(0, used);
+  }
   ~Bzip2CompressorS() {
     BZ2_bzCompressEnd(&strm);
   }
+  // The buffer to buffer call takes 32-bit sizes, so more input than that
+  // goes through a stream of its own in 32-bit pieces.
+  std::span<uint8_t> compressLarge(std::span<const uint8_t> in, std::span<uint8_t> out) {
+    bz_stream large = {};
+    int ret = BZ2_bzCompressInit(&large, blockSize, 0, 30);
+    assert(ret == BZ_OK);
+    size_t used = 0;
+    do {
+      size_t inPiece = std::min<size_t>(in.size(), UINT_MAX);
+      large.avail_in = (unsigned int)inPiece;
+      large.next_in = const_cast<char*>(reinterpret_cast<const char*>(in.data()));
+      large.avail_out = (unsigned int)std::min<size_t>(out.size() - used, UINT_MAX);
+      large.next_out = reinterpret_cast<char*>(out.data() + used);
+      unsigned int room = large.avail_out;
+      ret = BZ2_bzCompress(&large, inPiece == in.size() ? BZ_FINISH : BZ_RUN);
+      assert(ret >= 0);
+      in = in.subspan(inPiece - large.avail_in);
+      used += room - large.avail_out;
+    } while (ret != BZ_STREAM_END && used < out.size());
+    BZ2_bzCompressEnd(&large);
+    if (ret != BZ_STREAM_END) return {};
+    return out.subspan(0, used);
+  }
+  int blockSize;
   bz_stream strm;
 };
 
@@ -65,12 +106,17 @@ struct Bzip2DecompressorS : Decompressor {
       std::terminate();
     }
 
+    // libbzip2 refuses to be called again once the stream has ended.
+    if (ended) return {};
+    // It also counts output in 32 bits, so it fills at most that much.
+    out = out.first(std::min<size_t>(out.size(), UINT_MAX));
     strm.avail_out = (uint32_t)out.size();
     strm.next_out = reinterpret_cast<char*>(out.data());
     in_used += strm.avail_in;
     int ret = BZ2_bzDecompress(&strm);
     in_used -= strm.avail_in;
     assert(ret == BZ_OK || ret == BZ_STREAM_END);
+    ended = ret == BZ_STREAM_END;
     return out.subspan(0, out.size() - strm.avail_out);
   }
   ~Bzip2DecompressorS() {
@@ -81,6 +127,7 @@ struct Bzip2DecompressorS : Decompressor {
   }
   bz_stream strm;
   size_t in_used = 0;
+  bool ended = false;
 };
 
 std::unique_ptr<Decompressor> Bzip2Decompressor(size_t outputChunkSize) { return std::make_unique<Bzip2DecompressorS>(outputChunkSize); }
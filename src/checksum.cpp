@@ -0,0 +1,76 @@
+#include <decoco/decoco.hpp>
+#include "zlib/zlib.h"
+#include <algorithm>
+#include <thread>
+
+namespace Decoco {
+
+Crc32& Crc32::update(std::span<const uint8_t> in) {
+  if (in.empty()) return *this;
+  crc = Zlib::crc32(crc, in.data(), in.size());
+  length += in.size();
+  return *this;
+}
+
+Crc32& Crc32::combine(const Crc32& next) {
+  crc = Zlib::crc32_combine(crc, next.crc, next.length);
+  length += next.length;
+  return *this;
+}
+
+Adler32& Adler32::update(std::span<const uint8_t> in) {
+  if (in.empty()) return *this;
+  adler = Zlib::adler32(adler, in.data(), in.size());
+  length += in.size();
+  return *this;
+}
+
+Adler32& Adler32::combine(const Adler32& next) {
+  adler = Zlib::adler32_combine(adler, next.adler, next.length);
+  length += next.length;
+  return *this;
+}
+
+uint32_t crc32_combine(uint32_t crcA, uint32_t crcB, uint64_t lengthB) {
+  return Zlib::crc32_combine(crcA, crcB, lengthB);
+}
+
+uint32_t adler32_combine(uint32_t adlerA, uint32_t adlerB, uint64_t lengthB) {
+  return Zlib::adler32_combine(adlerA, adlerB, lengthB);
+}
+
+// Smaller slices are not worth starting a thread for.
+static constexpr size_t minSliceSize = 1 << 20;
+
+template <typename Checksum>
+static uint32_t checksumSlices(std::span<const uint8_t> in, size_t threads) {
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::clamp<size_t>(in.size() / minSliceSize, 1, threads);
+  size_t sliceSize = (in.size() + threads - 1) / threads;
+
+  std::vector<Checksum> slices(threads);
+  std::vector<std::thread> workers;
+  for (size_t n = 1; n < threads; n++) {
+    workers.emplace_back([&slices, in, n, sliceSize]{
+      slices[n].update(in.subspan(n * sliceSize, std::min(sliceSize, in.size() - n * sliceSize)));
+    });
+  }
+  slices[0].update(in.subspan(0, std::min(sliceSize, in.size())));
+  for (auto& t : workers) t.join();
+
+  for (size_t n = 1; n < threads; n++) {
+    slices[0].combine(slices[n]);
+  }
+  return slices[0].value();
+}
+
+uint32_t crc32(std::span<const uint8_t> in, size_t threads) {
+  return checksumSlices<Crc32>(in, threads);
+}
+
+uint32_t adler32(std::span<const uint8_t> in, size_t threads) {
+  return checksumSlices<Adler32>(in, threads);
+}
+
+}
+
@@ -1,5 +1,6 @@
 #include <decoco/decoco.hpp>
 #include "zlib/zlib.h"
+#include "parallel_deflate.h"
 #include <assert.h>
 
 namespace Decoco {
@@ -10,14 +11,14 @@ struct DeflateCompressorS : Compressor {
       default: 
       case Compressor::Level::Balanced: return Zlib::Z_DEFAULT_COMPRESSION;
       case Compressor::Level::Fast: return Zlib::Z_BEST_SPEED;
-      case Compressor::Level::Small: return Zlib::Z_BEST_COMPRESSION;
+      case Compressor::Level::Small: return Zlib::Z_OPTIMAL_COMPRESSION;
     }
   }
   DeflateCompressorS(Compressor::Level level, size_t chunkSize)
   : Compressor(chunkSize)
   , strm()
   {
-    int ret = deflateInit2(&strm, compressorLevelToDeflate(level), Zlib::Z_DEFLATED, -1, 8, Zlib::Z_DEFAULT_STRATEGY);
+    int ret = deflateInit2(&strm, compressorLevelToDeflate(level), Zlib::Z_DEFLATED, -15, 8, Zlib::Z_DEFAULT_STRATEGY);
     assert(ret == Zlib::Z_OK);
   }
   std::span<uint8_t> compress(std::span<const uint8_t> in, std::span<uint8_t> out) override {
@@ -40,20 +41,42 @@ struct DeflateCompressorS : Compressor {
     assert(ret != Zlib::Z_STREAM_ERROR);
     return out.subspan(0, out.size() - strm.avail_out);
   }
+  size_t compressBound(size_t size) const override {
+    return Zlib::deflateBound(const_cast<Zlib::z_stream*>(&strm), size);
+  }
+  std::span<uint8_t> compressInto(std::span<const uint8_t> in, std::span<uint8_t> out) override {
+    // deflate() does nothing without room for output.
+    if (out.empty()) return {};
+    if (strm.total_in || strm.total_out) Zlib::deflateReset(&strm);
+    strm.avail_in = in.size();
+    strm.next_in = const_cast<uint8_t*>(in.data());
+    strm.avail_out = out.size();
+    strm.next_out = out.data();
+    int ret = deflate(&strm, Zlib::Z_FINISH);
+    assert(ret != Zlib::Z_STREAM_ERROR);
+    if (ret != Zlib::Z_STREAM_END) return {};
+    return out.subspan(0, out.size() - strm.avail_out);
+  }
   ~DeflateCompressorS() {
     deflateEnd(&strm);
   }
   Zlib::z_stream strm;
 };
 
-std::unique_ptr<Compressor> DeflateCompressor(Compressor::Level level, size_t chunkSize) { return std::make_unique<DeflateCompressorS>(level, chunkSize); }
+std::unique_ptr<Compressor> DeflateCompressor(Compressor::Level level, size_t chunkSize) {
+  return std::make_unique<DeflateCompressorS>(level, chunkSize);
+}
+
+std::unique_ptr<Compressor> DeflateCompressor(Compressor::Level level, size_t chunkSize, size_t threads) {
+  return ParallelDeflateCompressor(DeflateWrapper::Raw, DeflateCompressorS::compressorLevelToDeflate(level), chunkSize, threads);
+}
 
 struct DeflateDecompressorS : Decompressor {
   DeflateDecompressorS(size_t outputChunkSize)
   : Decompressor(outputChunkSize)
   , strm()
   {
-    int ret = inflateInit2(&strm, -1);
+    int ret = inflateInit2(&strm, -15);
     assert(ret == Zlib::Z_OK);
   }
   std::span<uint8_t> decompress(std::span<const uint8_t> in, std::span<uint8_t> out) override {
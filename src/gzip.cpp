@@ -1,6 +1,16 @@
 #include <decoco/decoco.hpp>
 #include "zlib/zlib.h"
+#include "parallel_deflate.h"
+#include "parallel_inflate.h"
+#include "bgzf.h"
+#include "size_hint.h"
 #include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 namespace Decoco {
 
@@ -10,7 +20,7 @@ struct GzipCompressorS : Compressor {
       default: 
       case Compressor::Level::Balanced: return Zlib::Z_DEFAULT_COMPRESSION;
       case Compressor::Level::Fast: return Zlib::Z_BEST_SPEED;
-      case Compressor::Level::Small: return Zlib::Z_BEST_COMPRESSION;
+      case Compressor::Level::Small: return Zlib::Z_OPTIMAL_COMPRESSION;
     }
   }
   GzipCompressorS(Compressor::Level level, size_t chunkSize)
@@ -41,14 +51,44 @@ struct GzipCompressorS : Compressor {
     assert(ret != Zlib::Z_STREAM_ERROR);
     return out.subspan(0, out.size() - strm.avail_out);
   }
+  size_t compressBound(size_t size) const override {
+    return Zlib::deflateBound(const_cast<Zlib::z_stream*>(&strm), size);
+  }
+  std::span<uint8_t> compressInto(std::span<const uint8_t> in, std::span<uint8_t> out) override {
+    // deflate() does nothing without room for output.
+    if (out.empty()) return {};
+    if (strm.total_in || strm.total_out) Zlib::deflateReset(&strm);
+    strm.avail_in = in.size();
+    strm.next_in = const_cast<uint8_t*>(in.data());
+    strm.avail_out = out.size();
+    strm.next_out = out.data();
+    int ret = deflate(&strm, Zlib::Z_FINISH);
+    assert(ret != Zlib::Z_STREAM_ERROR);
+    if (ret != Zlib::Z_STREAM_END) return {};
+    return out.subspan(0, out.size() - strm.avail_out);
+  }
   ~GzipCompressorS() {
     deflateEnd(&strm);
   }
   Zlib::z_stream strm;
 };
 
-std::unique_ptr<Compressor> GzipCompressor(Compressor::Level level, size_t chunkSize) { return std::make_unique<GzipCompressorS>(level, chunkSize); }
+std::unique_ptr<Compressor> GzipCompressor(Compressor::Level level, size_t chunkSize) {
+  return std::make_unique<GzipCompressorS>(level, chunkSize);
+}
+
+std::unique_ptr<Compressor> GzipCompressor(Compressor::Level level, size_t chunkSize, size_t threads) {
+  return ParallelDeflateCompressor(DeflateWrapper::Gzip, GzipCompressorS::compressorLevelToZlib(level), chunkSize, threads);
+}
+
+// Whether in starts like another gzip member. Anything else after a member is
+// padding or garbage, which gzip ignores as well.
+static bool startsMember(const uint8_t* in, size_t size) {
+  return size >= 1 && in[0] == 0x1f && (size == 1 || in[1] == 0x8b);
+}
 
+// A gzip file can hold several members one after the other, as `cat a.gz b.gz`
+// makes. Their output is simply joined.
 struct GzipDecompressorS : Decompressor {
   GzipDecompressorS(size_t outputChunkSize)
   : Decompressor(outputChunkSize)
@@ -70,9 +110,26 @@ struct GzipDecompressorS : Decompressor {
     strm.avail_out = out.size();
     strm.next_out = out.data();
     in_used += strm.avail_in;
-    int ret = inflate(&strm, Zlib::Z_NO_FLUSH);
+    while (true) {
+      if (memberEnded) {
+        if (strm.avail_in == 0) break;
+        if (trailing || !startsMember(strm.next_in, strm.avail_in)) {
+          trailing = true;
+          in_used -= strm.avail_in;
+          strm.avail_in = 0;
+          break;
+        }
+        inflateReset(&strm);
+        memberEnded = false;
+      }
+      // Z_BUF_ERROR only says that all input was used up before this call.
+      int ret = inflate(&strm, Zlib::Z_NO_FLUSH);
+      assert(ret == Zlib::Z_OK || ret == Zlib::Z_STREAM_END || ret == Zlib::Z_BUF_ERROR);
+      if (ret != Zlib::Z_STREAM_END) break;
+      memberEnded = true;
+      if (strm.avail_out == 0) break;
+    }
     in_used -= strm.avail_in;
-    assert(ret == Zlib::Z_OK || ret == Zlib::Z_STREAM_END);
     return out.subspan(0, out.size() - strm.avail_out);
   }
   ~GzipDecompressorS() {
@@ -82,10 +139,261 @@ struct GzipDecompressorS : Decompressor {
     return in_used;
   }
   size_t in_used = 0;
+  bool memberEnded = false;
+  bool trailing = false;
+  Zlib::z_stream strm;
+};
+
+std::unique_ptr<Decompressor> GzipDecompressor(size_t outputChunkSize, size_t threads) {
+  if (threads != 1) return ParallelGzipDecompressor(outputChunkSize, threads);
+  return std::make_unique<GzipDecompressorS>(outputChunkSize);
+}
+
+// Gzip decompression as a pipeline of three threads: one inflates into a ring
+// of output blocks, one computes the CRC-32 of each block as it is filled and
+// compares it with the member's trailer, and the caller's thread copies the
+// blocks out. inflate leaves the checking to the other thread, and goes on
+// into free blocks while the caller does something with its output.
+struct PipelinedGzipDecompressorS : Decompressor {
+  struct Block {
+    std::unique_ptr<uint8_t[]> data;
+    size_t size = 0;
+    bool ends = false;       // the last output of a member
+    uint32_t crc = 0;        // from the trailer of that member
+    size_t memberStart = 0;  // and where in the input it started
+    size_t memberBlock = 0;  // and in which block
+  };
+
+  PipelinedGzipDecompressorS(size_t outputChunkSize)
+  : Decompressor(outputChunkSize)
+  , blockSize(std::max<size_t>(outputChunkSize, 65536))
+  , strm()
+  {
+    int ret = inflateInit2(&strm, 31);
+    assert(ret == Zlib::Z_OK);
+    inflateValidate(&strm, 0);
+    for (auto& block : blocks) block.data = std::make_unique_for_overwrite<uint8_t[]>(blockSize);
+    inflater = std::thread([this]{ inflateBlocks(); });
+    checker = std::thread([this]{ checkBlocks(); });
+  }
+  ~PipelinedGzipDecompressorS() {
+    {
+      std::lock_guard<std::mutex> lock(m);
+      stopping = true;
+    }
+    inflatable.notify_one();
+    checkable.notify_one();
+    inflater.join();
+    checker.join();
+    inflateEnd(&strm);
+  }
+  std::span<uint8_t> decompress(std::span<const uint8_t> in, std::span<uint8_t> out) override {
+    std::unique_lock<std::mutex> lock(m);
+    if (!pending.empty() && !in.empty()) {
+      // you can't put more data in before the rest is taken out
+      std::terminate();
+    }
+    if (!in.empty() && !trailing) {
+      pending = in;
+      inflatable.notify_one();
+    }
+    size_t n = 0;
+    while (n < out.size()) {
+      readable.wait(lock, [this]{ return bad || taken < produced || pending.empty(); });
+      if (taken >= good()) {
+        // All input is inflated. Output short of a full chunk says that there
+        // is no more for now, so the checks of what was returned come first.
+        readable.wait(lock, [this]{ return checked == produced; });
+        if (taken >= good()) break;
+      }
+      Block& block = blocks[taken % blocks.size()];
+      size_t k = std::min(out.size() - n, block.size - takenOffset);
+      lock.unlock();
+      memcpy(out.data() + n, block.data.get() + takenOffset, k);
+      lock.lock();
+      n += k;
+      takenOffset += k;
+      if (takenOffset == block.size) {
+        taken++;
+        takenOffset = 0;
+        inflatable.notify_one();
+      }
+    }
+    in_used = bad ? badMember : inflated;
+    return out.subspan(0, n);
+  }
+  size_t bytesUsed() const override {
+    return in_used;
+  }
+
+private:
+  // Blocks up to here can be returned; those of a member that fails its check
+  // and after are not.
+  size_t good() const {
+    return bad ? badBlock : produced;
+  }
+  void inflateBlocks() {
+    std::unique_lock<std::mutex> lock(m);
+    while (true) {
+      inflatable.wait(lock, [this]{ return stopping || (!pending.empty() && produced - std::min(taken, checked) < blocks.size()); });
+      if (stopping) return;
+      Block& block = blocks[produced % blocks.size()];
+      std::span<const uint8_t> in = pending;
+      lock.unlock();
+      bool last = false;
+      size_t used = fill(block, in, last);
+      lock.lock();
+      inflated += used;
+      if (last) trailing = true;
+      pending = trailing ? std::span<const uint8_t>() : pending.subspan(used);
+      if (!bad && (block.size || block.ends)) {
+        produced++;
+        checkable.notify_one();
+      }
+      readable.notify_one();
+    }
+  }
+  // Inflate from in into block until either is used up or a member ends, and
+  // return how much of in was used. Sets last at the end of the gzip data, or
+  // at corrupt data.
+  size_t fill(Block& block, std::span<const uint8_t> in, bool& last) {
+    block.size = 0;
+    block.ends = false;
+    strm.next_in = in.data();
+    strm.avail_in = in.size();
+    strm.next_out = block.data.get();
+    strm.avail_out = blockSize;
+    if (memberEnded) {
+      if (!startsMember(strm.next_in, strm.avail_in)) {
+        last = true;
+        return 0;
+      }
+      inflateReset(&strm);
+      memberEnded = false;
+      memberStart = inflated;
+      memberBlock = produced;
+    }
+    int ret = inflate(&strm, Zlib::Z_NO_FLUSH);
+    block.size = blockSize - strm.avail_out;
+    if (ret == Zlib::Z_STREAM_END) {
+      // inflateValidate() left the CRC-32 from the trailer in adler.
+      memberEnded = true;
+      block.ends = true;
+      block.crc = strm.adler;
+      block.memberStart = memberStart;
+      block.memberBlock = memberBlock;
+    } else if (ret != Zlib::Z_OK && ret != Zlib::Z_BUF_ERROR) {
+      last = true;
+    }
+    return in.size() - strm.avail_in;
+  }
+  void checkBlocks() {
+    std::unique_lock<std::mutex> lock(m);
+    uint32_t crc = 0;
+    while (true) {
+      checkable.wait(lock, [this]{ return stopping || checked < produced; });
+      if (stopping) return;
+      Block& block = blocks[checked % blocks.size()];
+      lock.unlock();
+      crc = Zlib::crc32(crc, block.data.get(), block.size);
+      bool ok = !block.ends || crc == block.crc;
+      if (block.ends) crc = 0;
+      lock.lock();
+      checked++;
+      if (!ok && !bad) {
+        // Everything from the start of the member on counts as not used.
+        bad = true;
+        trailing = true;
+        badMember = block.memberStart;
+        badBlock = block.memberBlock;
+        pending = {};
+      }
+      inflatable.notify_one();
+      readable.notify_one();
+    }
+  }
+
+  size_t blockSize;
+  std::array<Block, 8> blocks;
+  // Blocks are used in turn; each is inflated, then checked and taken out.
+  size_t produced = 0, checked = 0, taken = 0, takenOffset = 0;
+  std::span<const uint8_t> pending; // input not yet inflated
+  size_t inflated = 0, memberStart = 0, memberBlock = 0, badMember = 0, badBlock = 0, in_used = 0;
+  bool memberEnded = false, trailing = false, bad = false, stopping = false;
   Zlib::z_stream strm;
+
+  std::mutex m;
+  std::condition_variable inflatable, checkable, readable;
+  std::thread inflater, checker;
 };
 
-std::unique_ptr<Decompressor> GzipDecompressor(size_t outputChunkSize) { return std::make_unique<GzipDecompressorS>(outputChunkSize); }
+std::unique_ptr<Decompressor> PipelinedGzipDecompressor(size_t outputChunkSize) {
+  return std::make_unique<PipelinedGzipDecompressorS>(outputChunkSize);
+}
+
+// The gzip trailer ends with the size of the member's output, modulo 4 GiB.
+// BGZF blocks say where the next one starts, so for BGZF the sizes of all of
+// them are added up; for other gzip data only the last member can be found.
+uint64_t GzipSizeHint(std::span<const uint8_t> in) {
+  if (in.size() < 18) return 0;
+  auto isize = [in](size_t end) {
+    const uint8_t* p = in.data() + end - 4;
+    return uint64_t(p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24));
+  };
+  uint64_t total = 0;
+  size_t pos = 0;
+  while (size_t size = BgzfBlockSize(in, pos)) {
+    if (size > in.size() - pos) break;
+    pos += size;
+    total += isize(pos);
+    if (pos == in.size()) return total;
+  }
+  return isize(in.size());
+}
+
+
+// The gzip trailer tells the size of the output (modulo 4 GiB), so the output
+// usually fits in one buffer allocated up front. inflate then copies matches
+// from earlier in that buffer and never fills a window. Only the size of the
+// last member is known that way, unless the file is BGZF; more members grow
+// the buffer as they go.
+std::vector<uint8_t> gunzip(std::span<const uint8_t> in, size_t threads) {
+  std::vector<uint8_t> out;
+  if (threads != 1) {
+    // Several members are decompressed side by side, and a single large one
+    // in parts.
+    if (FindGzipMember(in, 1) != in.size()) return ParallelGzipDecompressor(1 << 20, threads)->decompress(in);
+    if (ParallelGunzip(in, threads, out)) return out;
+  }
+  out.resize(std::min<uint64_t>(GzipSizeHint(in), in.size() * maxDeflateRatio));
+
+  Zlib::z_stream strm = {};
+  int ret = inflateInit2(&strm, 31);
+  assert(ret == Zlib::Z_OK);
+  inflateNoWindow(&strm);
+  strm.next_in = in.data();
+  strm.avail_in = in.size();
+  size_t used = 0;
+  while (true) {
+    if (used == out.size()) out.resize(std::max<size_t>(2 * out.size(), 32768));
+    strm.next_out = out.data() + used;
+    strm.avail_out = out.size() - used;
+    ret = inflate(&strm, Zlib::Z_FINISH);
+    used = out.size() - strm.avail_out;
+    // The next member writes on after this one, which inflate allows without
+    // a window as it only looks back as far as the start of the member.
+    if (ret == Zlib::Z_STREAM_END && startsMember(strm.next_in, strm.avail_in)) {
+      inflateReset(&strm);
+      continue;
+    }
+    // Out of output space; anything else is the end, or truncated input.
+    if (ret != Zlib::Z_BUF_ERROR || strm.avail_out != 0) break;
+  }
+  assert(ret == Zlib::Z_STREAM_END || ret == Zlib::Z_BUF_ERROR);
+  inflateEnd(&strm);
+  out.resize(used);
+  return out;
+}
 
 }
 
@@ -0,0 +1,43 @@
+#include <decoco/decoco.hpp>
+#include "zlib/cpu_features.h"
+
+namespace Decoco {
+
+std::vector<Kernel> kernels() {
+  std::vector<Kernel> result;
+  for (size_t n = 0; n < Zlib::kernel_count; n++) {
+    Zlib::kernel* k = Zlib::kernels[n];
+    Kernel info;
+    info.name = k->name;
+    const Zlib::kernel_variant* active = k->active.load();
+    if (active == nullptr) active = Zlib::kernel_resolve(k);
+    info.active = active->name;
+    for (size_t v = 0; v < k->count; v++) {
+      if (Zlib::kernel_supported(&k->variants[v])) info.supported.push_back(k->variants[v].name);
+    }
+    result.push_back(std::move(info));
+  }
+  return result;
+}
+
+bool forceKernel(std::string_view kernel, std::string_view variant) {
+  for (size_t n = 0; n < Zlib::kernel_count; n++) {
+    Zlib::kernel* k = Zlib::kernels[n];
+    if (k->name != kernel) continue;
+    if (variant.empty()) {
+      Zlib::kernel_set(k, nullptr);
+      return true;
+    }
+    for (size_t v = 0; v < k->count; v++) {
+      if (k->variants[v].name == variant && Zlib::kernel_supported(&k->variants[v])) {
+        Zlib::kernel_set(k, &k->variants[v]);
+        return true;
+      }
+    }
+    return false;
+  }
+  return false;
+}
+
+}
+
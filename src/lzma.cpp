@@ -1,5 +1,6 @@
 #include <decoco/decoco.hpp>
 #include <lzma.h>
+#include "size_hint.h"
 #include <assert.h>
 
 namespace Decoco {
@@ -15,9 +16,10 @@ struct LzmaCompressorS : Compressor {
   }
   LzmaCompressorS(Compressor::Level level, size_t chunkSize)
   : Compressor(chunkSize)
+  , preset(compressorLevelToLzmalib(level))
   , strm()
   {
-    int ret = lzma_easy_encoder(&strm, compressorLevelToLzmalib(level), LZMA_CHECK_CRC64);
+    int ret = lzma_easy_encoder(&strm, preset, LZMA_CHECK_CRC64);
     assert(ret == LZMA_OK);
   }
   std::span<uint8_t> compress(std::span<const uint8_t> in, std::span<uint8_t> out) override {
@@ -40,9 +42,22 @@ struct LzmaCompressorS : Compressor {
     assert(ret == LZMA_OK || ret == LZMA_STREAM_END);
     return out.subspan(0, out.size() - strm.avail_out);
   }
+  size_t compressBound(size_t size) const override {
+    return lzma_stream_buffer_bound(size);
+  }
+  std::span<uint8_t> compressInto(std::span<const uint8_t> in, std::span<uint8_t> out) override {
+    // No stream is empty, and liblzma takes a missing buffer for an error.
+    if (out.empty()) return {};
+    size_t used = 0;
+    int ret = lzma_easy_buffer_encode(preset, LZMA_CHECK_CRC64, nullptr, in.data(), in.size(), out.data(), &used, out.size());
+    if (ret == LZMA_BUF_ERROR) return {};
+    assert(ret == LZMA_OK);
+    return out.subspan(0, used);
+  }
   ~LzmaCompressorS() {
     lzma_end(&strm);
   }
+  uint32_t preset;
   lzma_stream strm;
 };
 
@@ -85,6 +100,32 @@ struct LzmaDecompressorS : Decompressor {
 
 std::unique_ptr<Decompressor> LzmaDecompressor(size_t outputChunkSize) { return std::make_unique<LzmaDecompressorS>(outputChunkSize); }
 
+// An xz stream ends in an index that lists the sizes of its blocks, after
+// which the stream footer says how large the index is. Streams can follow
+// each other, with padding of zero bytes in fours after each one, so they are
+// taken from the end.
+uint64_t XzSizeHint(std::span<const uint8_t> in) {
+  uint64_t total = 0;
+  size_t end = in.size();
+  while (end > 0) {
+    while (end >= 4 && !in[end - 1] && !in[end - 2] && !in[end - 3] && !in[end - 4]) end -= 4;
+    if (end < 2 * LZMA_STREAM_HEADER_SIZE) return 0;
+    lzma_stream_flags flags;
+    if (lzma_stream_footer_decode(&flags, in.data() + end - LZMA_STREAM_HEADER_SIZE) != LZMA_OK) return 0;
+    if (flags.backward_size > end - 2 * LZMA_STREAM_HEADER_SIZE) return 0;
+    size_t pos = end - LZMA_STREAM_HEADER_SIZE - flags.backward_size;
+    lzma_index* index = nullptr;
+    uint64_t memlimit = UINT64_MAX;
+    if (lzma_index_buffer_decode(&index, &memlimit, nullptr, in.data(), &pos, end - LZMA_STREAM_HEADER_SIZE) != LZMA_OK) return 0;
+    total += lzma_index_uncompressed_size(index);
+    uint64_t streamSize = lzma_index_stream_size(index);
+    lzma_index_end(index, nullptr);
+    if (streamSize > end) return 0;
+    end -= streamSize;
+  }
+  return total;
+}
+
 }
 
 
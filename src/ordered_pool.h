@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Decoco {
+
+// Jobs done on a pool of threads and handed back in the order they were
+// submitted. run() does a job; on a worker, or on the caller's thread inside
+// submit() if there is only one thread. take() gets each finished job on the
+// caller's thread, from submit() and collect(). No more than two jobs per
+// thread are in flight at a time, so that a fast caller does not queue up all
+// of its input.
+template <class Job>
+class OrderedPool {
+public:
+  // threads is 0 for one per core.
+  OrderedPool(size_t threads, std::function<void(Job&)> run, std::function<void(Job&)> take)
+  : run(std::move(run))
+  , take(std::move(take))
+  {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    maxInFlight = 2 * threads;
+    for (size_t n = 0; threads > 1 && n < threads; n++) {
+      workers.emplace_back([this]{ work(); });
+    }
+  }
+  // Jobs that were not started are dropped.
+  ~OrderedPool() {
+    {
+      std::lock_guard<std::mutex> lock(m);
+      todo.clear();
+      stopping = true;
+    }
+    queued.notify_all();
+    for (auto& t : workers) t.join();
+  }
+  void submit(Job job) {
+    auto item = std::make_shared<Item>(std::move(job));
+    if (workers.empty()) {
+      run(item->job);
+      item->done = true;
+      inFlight.push_back(item);
+    } else {
+      {
+        std::lock_guard<std::mutex> lock(m);
+        inFlight.push_back(item);
+        todo.push_back(item);
+      }
+      queued.notify_one();
+    }
+    collect(false);
+  }
+  // Hand finished jobs to take() in order. Waits for jobs to finish if there
+  // are too many in flight, or for all of them if all is set.
+  void collect(bool all) {
+    std::unique_lock<std::mutex> lock(m);
+    while (!inFlight.empty()) {
+      if (!inFlight.front()->done) {
+        if (!all && inFlight.size() < maxInFlight) return;
+        finished.wait(lock, [this]{ return inFlight.front()->done; });
+      }
+      std::shared_ptr<Item> item = std::move(inFlight.front());
+      inFlight.pop_front();
+      lock.unlock();
+      take(item->job);
+      lock.lock();
+    }
+  }
+  // Whether all jobs have been taken.
+  bool empty() const {
+    return inFlight.empty();
+  }
+
+private:
+  struct Item {
+    explicit Item(Job job) : job(std::move(job)) {}
+    Job job;
+    bool done = false;
+  };
+
+  void work() {
+    std::unique_lock<std::mutex> lock(m);
+    while (true) {
+      queued.wait(lock, [this]{ return stopping || !todo.empty(); });
+      if (todo.empty()) return;
+      std::shared_ptr<Item> item = std::move(todo.front());
+      todo.pop_front();
+      lock.unlock();
+      run(item->job);
+      lock.lock();
+      item->done = true;
+      finished.notify_one();
+    }
+  }
+
+  std::function<void(Job&)> run, take;
+  size_t maxInFlight;
+  std::mutex m;
+  std::condition_variable queued, finished;
+  std::deque<std::shared_ptr<Item>> todo, inFlight;
+  bool stopping = false;
+  std::vector<std::thread> workers;
+};
+
+}
@@ -0,0 +1,203 @@
+#include "parallel_deflate.h"
+#include "zlib/zlib.h"
+#include "bgzf.h"
+#include <assert.h>
+#include <string.h>
+#include "ordered_pool.h"
+#include <algorithm>
+
+namespace Decoco {
+
+// The input is cut into blocks of this size whatever the number of threads,
+// which is what keeps the output independent of it. BGZF has its own.
+static constexpr size_t blockSize = 128 * 1024;
+// Each block is primed with this much of the input before it, the full
+// deflate window, so that matches can reach back across block boundaries.
+static constexpr size_t dictionarySize = 32 * 1024;
+
+struct ParallelDeflateCompressorS : Compressor {
+  struct Block {
+    std::vector<uint8_t> in; // dictionary followed by the block itself
+    size_t dictSize = 0;
+    bool last = false;
+    std::vector<uint8_t> out;
+    uint32_t check = 0;
+  };
+
+  ParallelDeflateCompressorS(DeflateWrapper wrapper, int level, size_t chunkSize, size_t threads)
+  : Compressor(chunkSize)
+  , wrapper(wrapper)
+  , level(level == Zlib::Z_DEFAULT_COMPRESSION ? 6 : level)
+  , blockInput(wrapper == DeflateWrapper::Bgzf ? bgzfBlockInput : blockSize)
+  , blocks(threads, [this](Block& block) { compressBlock(block); }, [this](Block& block) { append(block); })
+  {
+    writeHeader();
+  }
+  std::span<uint8_t> compress(std::span<const uint8_t> in, std::span<uint8_t> out) override {
+    // The stream has ended; its last block is gone and input has nowhere to go.
+    if (flushed) return {};
+    while (!in.empty()) {
+      size_t n = std::min(in.size(), blockInput - (current.in.size() - current.dictSize));
+      current.in.insert(current.in.end(), in.begin(), in.begin() + n);
+      in = in.subspan(n);
+      if (current.in.size() - current.dictSize == blockInput) submit(false);
+    }
+    blocks.collect(false);
+    return drain(out);
+  }
+  std::span<uint8_t> flush(std::span<uint8_t> out) override {
+    if (!flushed) {
+      submit(true);
+      blocks.collect(true);
+      flushed = true;
+    }
+    return drain(out);
+  }
+  // Every block may end in an empty stored block for the sync flush, or is a
+  // BGZF block with its own header and trailer, on top of what deflate makes
+  // of its input.
+  size_t compressBound(size_t size) const override {
+    size_t blocks = size / blockInput + 1;
+    size_t perBlock = wrapper == DeflateWrapper::Bgzf ? 26 + 7 : 5 + 7;
+    size_t wrapping = wrapper == DeflateWrapper::Gzip ? 18 : wrapper == DeflateWrapper::Zlib ? 6 : wrapper == DeflateWrapper::Bgzf ? sizeof(bgzfEof) : 0;
+    return Zlib::deflateRawBound(size) + blocks * perBlock + wrapping;
+  }
+  std::span<uint8_t> compressInto(std::span<const uint8_t> in, std::span<uint8_t> out) override {
+    restart();
+    compress(in, {});
+    auto result = flush(out);
+    // Whatever did not fit is dropped by the next restart.
+    if (!pending.empty()) return {};
+    return result;
+  }
+
+private:
+  // Drop the stream so far and start a new one.
+  void restart() {
+    blocks.collect(true);
+    current = Block();
+    pending.clear();
+    pendingOffset = 0;
+    totalIn = 0;
+    flushed = false;
+    writeHeader();
+  }
+  void writeHeader() {
+    if (wrapper == DeflateWrapper::Gzip) {
+      uint8_t xfl = level >= 9 ? 2 : level < 2 ? 4 : 0;
+      pending = { 0x1f, 0x8b, Zlib::Z_DEFLATED, 0, 0, 0, 0, 0, xfl, 3 };
+      check = Zlib::crc32(0, nullptr, 0);
+    } else if (wrapper == DeflateWrapper::Zlib) {
+      uint16_t header = (Zlib::Z_DEFLATED + ((Zlib::MAX_WBITS - 8) << 4)) << 8;
+      uint16_t levelFlags = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+      header |= levelFlags << 6;
+      header += 31 - (header % 31);
+      pending = { uint8_t(header >> 8), uint8_t(header) };
+      check = Zlib::adler32(0, nullptr, 0);
+    }
+  }
+  void writeTrailer() {
+    if (wrapper == DeflateWrapper::Gzip) {
+      for (uint32_t v : { check, uint32_t(totalIn) }) {
+        for (int n = 0; n < 32; n += 8) pending.push_back(uint8_t(v >> n));
+      }
+    } else if (wrapper == DeflateWrapper::Zlib) {
+      for (int n = 24; n >= 0; n -= 8) pending.push_back(uint8_t(check >> n));
+    } else if (wrapper == DeflateWrapper::Bgzf) {
+      pending.insert(pending.end(), std::begin(bgzfEof), std::end(bgzfEof));
+    }
+  }
+  // Hand the current block to the workers and start the next one, primed with
+  // the end of this one.
+  void submit(bool last) {
+    current.last = last;
+    Block next;
+    if (!last) {
+      // BGZF blocks are decompressed on their own, so they cannot refer back.
+      size_t dict = wrapper == DeflateWrapper::Bgzf ? 0 : std::min(dictionarySize, current.in.size());
+      next.in.assign(current.in.end() - dict, current.in.end());
+      next.dictSize = dict;
+    }
+    blocks.submit(std::move(current));
+    current = std::move(next);
+  }
+  void append(const Block& block) {
+    size_t len = block.in.size() - block.dictSize;
+    pending.insert(pending.end(), block.out.begin(), block.out.end());
+    if (wrapper == DeflateWrapper::Gzip) {
+      check = Zlib::crc32_combine(check, block.check, len);
+    } else if (wrapper == DeflateWrapper::Zlib) {
+      check = Zlib::adler32_combine(check, block.check, len);
+    }
+    totalIn += len;
+    if (block.last) writeTrailer();
+  }
+  std::span<uint8_t> drain(std::span<uint8_t> out) {
+    size_t n = std::min(out.size(), pending.size() - pendingOffset);
+    if (n) memcpy(out.data(), pending.data() + pendingOffset, n);
+    pendingOffset += n;
+    if (pendingOffset == pending.size()) {
+      pending.clear();
+      pendingOffset = 0;
+    }
+    return out.subspan(0, n);
+  }
+  // Compress one block as raw deflate. All but the last end in a sync flush, so
+  // that the next block starts on a byte boundary and the pieces can simply be
+  // concatenated.
+  void compressBlock(Block& block) const {
+    const uint8_t* data = block.in.data() + block.dictSize;
+    size_t len = block.in.size() - block.dictSize;
+    if (wrapper == DeflateWrapper::Bgzf) {
+      if (len) block.out = BgzfBlock(std::span<const uint8_t>(data, len), level);
+      return;
+    }
+    if (wrapper == DeflateWrapper::Gzip) {
+      block.check = Zlib::crc32(0, data, len);
+    } else if (wrapper == DeflateWrapper::Zlib) {
+      block.check = Zlib::adler32(1, data, len);
+    }
+
+    Zlib::z_stream strm = {};
+    int ret = deflateInit2(&strm, level, Zlib::Z_DEFLATED, -Zlib::MAX_WBITS, 8, Zlib::Z_DEFAULT_STRATEGY);
+    assert(ret == Zlib::Z_OK);
+    if (block.dictSize) {
+      ret = deflateSetDictionary(&strm, block.in.data(), block.dictSize);
+      assert(ret == Zlib::Z_OK);
+    }
+    strm.next_in = data;
+    strm.avail_in = len;
+    block.out.resize(len + len / 8 + 64);
+    size_t used = 0;
+    while (true) {
+      strm.next_out = block.out.data() + used;
+      strm.avail_out = block.out.size() - used;
+      ret = deflate(&strm, block.last ? Zlib::Z_FINISH : Zlib::Z_SYNC_FLUSH);
+      assert(ret != Zlib::Z_STREAM_ERROR);
+      used = block.out.size() - strm.avail_out;
+      if (strm.avail_out != 0) break;
+      block.out.resize(block.out.size() * 2);
+    }
+    block.out.resize(used);
+    deflateEnd(&strm);
+  }
+
+  DeflateWrapper wrapper;
+  int level;
+  size_t blockInput;
+  Block current;
+  std::vector<uint8_t> pending;
+  size_t pendingOffset = 0;
+  uint32_t check = 0;
+  uint64_t totalIn = 0;
+  bool flushed = false;
+  // Last, so that its workers stop before the rest goes.
+  OrderedPool<Block> blocks;
+};
+
+std::unique_ptr<Compressor> ParallelDeflateCompressor(DeflateWrapper wrapper, int level, size_t chunkSize, size_t threads) {
+  return std::make_unique<ParallelDeflateCompressorS>(wrapper, level, chunkSize, threads);
+}
+
+}
+
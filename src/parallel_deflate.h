@@ -0,0 +1,21 @@
+#pragma once
+
+#include <decoco/decoco.hpp>
+
+namespace Decoco {
+
+enum class DeflateWrapper {
+  Raw,
+  Zlib,
+  Gzip,
+  Bgzf,
+};
+
+// Compresses independent blocks of the input on a pool of threads and joins
+// them into a single stream with the given wrapper, or into a series of BGZF
+// blocks. The output depends only on the input and the level, not on the
+// number of threads. With one thread, blocks are compressed by the caller.
+std::unique_ptr<Compressor> ParallelDeflateCompressor(DeflateWrapper wrapper, int level, size_t chunkSize, size_t threads);
+
+}
+
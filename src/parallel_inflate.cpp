@@ -0,0 +1,441 @@
+#include "parallel_inflate.h"
+#include "zlib/zlib.h"
+#include "zlib/infmark.h"
+#include "bgzf.h"
+#include "ordered_pool.h"
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <thread>
+
+namespace Decoco {
+
+// Less compressed data than this per thread is not worth the search for a
+// block to start at.
+static constexpr size_t minChunkSize = 1 << 20;
+
+// A run of deflate blocks decoded on its own: the bits from begin up to end,
+// which is either the first dynamic block at or after the position where the
+// next chunk starts looking, or the end of the last block.
+struct Chunk {
+  uint64_t begin = 0, end = 0;
+  bool ok = false;
+  bool last = false;
+  std::unique_ptr<uint16_t[]> out; // MARKER_WINDOW markers, then the output
+  uint64_t have = 0, size = 0;
+  std::vector<uint8_t> window;     // the output before this chunk, once known
+  uint64_t offset = 0;             // of this chunk's output in the whole output
+};
+
+// 2 is a block with dynamic codes that is not the last.
+static bool stopsAt(std::span<const uint8_t> in, uint64_t pos, uint64_t stop) {
+  return pos >= stop && Zlib::inflate_block_type(in.data(), in.size(), pos) == 2;
+}
+
+// Decode blocks from pos until the first non-final dynamic block at or after
+// stop, not knowing the window before them.
+static bool decodeChunk(std::span<const uint8_t> in, uint64_t pos, uint64_t stop, Chunk& chunk) {
+  chunk.begin = pos;
+  // Room for the output of typical data, grown if that is not enough.
+  uint64_t compressed = std::min<uint64_t>(in.size(), stop / 8) - std::min<uint64_t>(in.size(), std::min(pos, stop) / 8);
+  chunk.size = MARKER_WINDOW + MARKER_MIN_LEFT + 4 * compressed;
+  chunk.out = std::make_unique_for_overwrite<uint16_t[]>(chunk.size);
+  Zlib::inflate_markers_init(chunk.out.get());
+  chunk.have = MARKER_WINDOW;
+  while (!stopsAt(in, pos, stop)) {
+    int ret = Zlib::inflate_markers(in.data(), in.size(), &pos, chunk.out.get(), &chunk.have, chunk.size, 0);
+    if (ret == Zlib::Z_BUF_ERROR) {
+      auto larger = std::make_unique_for_overwrite<uint16_t[]>(2 * chunk.size);
+      std::copy(chunk.out.get(), chunk.out.get() + chunk.have, larger.get());
+      chunk.out = std::move(larger);
+      chunk.size *= 2;
+    } else if (ret == Zlib::Z_STREAM_END) {
+      chunk.last = true;
+      break;
+    } else if (ret != Zlib::Z_OK) {
+      return false;
+    }
+  }
+  chunk.end = pos;
+  return true;
+}
+
+// The first chunk has no window to wait for, so inflate decodes it straight
+// into out, stopping at block boundaries to see where it ends.
+static bool inflateFirstChunk(std::span<const uint8_t> in, uint64_t stop, std::vector<uint8_t>& out, Chunk& chunk) {
+  Zlib::z_stream strm = {};
+  int ret = inflateInit2(&strm, -15);
+  if (ret != Zlib::Z_OK) return false;
+  inflateNoWindow(&strm);
+  strm.next_in = in.data();
+  strm.avail_in = in.size();
+  out.resize(MARKER_WINDOW + 4 * std::min<uint64_t>(in.size(), stop / 8));
+  size_t used = 0;
+  while (true) {
+    if (used == out.size()) out.resize(2 * out.size());
+    strm.next_out = out.data() + used;
+    strm.avail_out = out.size() - used;
+    ret = inflate(&strm, Zlib::Z_BLOCK);
+    used = out.size() - strm.avail_out;
+    if (ret == Zlib::Z_STREAM_END) {
+      chunk.end = strm.total_in * 8;
+      chunk.last = true;
+      break;
+    }
+    if (ret != Zlib::Z_OK) break;
+    uint64_t pos = strm.total_in * 8 - (strm.data_type & 63);
+    if ((strm.data_type & 128) && stopsAt(in, pos, stop)) {
+      chunk.end = pos;
+      break;
+    }
+  }
+  inflateEnd(&strm);
+  out.resize(used);
+  chunk.size = used;
+  return ret == Zlib::Z_OK || ret == Zlib::Z_STREAM_END;
+}
+
+// Find the first block at or after bit from that decodes up to stop.
+static void findAndDecodeChunk(std::span<const uint8_t> in, uint64_t from, uint64_t stop, Chunk& chunk) {
+  uint64_t pos = from;
+  while (Zlib::inflate_find_block(in.data(), in.size(), &pos)) {
+    if (decodeChunk(in, pos, stop, chunk)) {
+      chunk.ok = true;
+      return;
+    }
+    pos++;
+  }
+  chunk.out = nullptr;
+}
+
+// Replace the markers in decoded output with the bytes of the window they
+// stand for, and narrow the rest to bytes. Most of the output past the first
+// few KiB of a chunk has no markers left, which the first loop takes quickly.
+static void resolve(const uint16_t* in, size_t n, const uint8_t* window, uint8_t* out) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    uint16_t any = 0;
+    for (size_t j = 0; j < 16; j++) any |= in[i + j];
+    if (any < 256) {
+      for (size_t j = 0; j < 16; j++) out[i + j] = uint8_t(in[i + j]);
+    } else {
+      for (size_t j = 0; j < 16; j++) out[i + j] = in[i + j] < 256 ? uint8_t(in[i + j]) : window[in[i + j] - MARKER];
+    }
+  }
+  for (; i < n; i++) {
+    out[i] = in[i] < 256 ? uint8_t(in[i]) : window[in[i] - MARKER];
+  }
+}
+
+bool ParallelGunzip(std::span<const uint8_t> in, size_t threads, std::vector<uint8_t>& out) {
+  // Let inflate read the header, up to the first block.
+  Zlib::z_stream strm = {};
+  int ret = inflateInit2(&strm, 31);
+  if (ret != Zlib::Z_OK) return false;
+  uint8_t none;
+  strm.next_in = in.data();
+  strm.avail_in = in.size();
+  strm.next_out = &none;
+  strm.avail_out = 1;
+  ret = inflate(&strm, Zlib::Z_BLOCK);
+  bool header = ret == Zlib::Z_OK && (strm.data_type & 128) && strm.total_out == 0;
+  size_t start = strm.total_in;
+  inflateEnd(&strm);
+  if (!header || in.size() < start + 8) return false;
+
+  std::span<const uint8_t> deflate = in.subspan(start, in.size() - start - 8);
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t n = std::clamp<size_t>(deflate.size() / minChunkSize, 1, threads);
+  if (n == 1) return false;
+  uint64_t chunkSize = (deflate.size() + n - 1) / n;
+
+  // Decode all chunks at once, the first from the start of the stream and the
+  // others from the first block found at their nominal start.
+  std::vector<Chunk> chunks(n);
+  std::vector<std::thread> workers;
+  for (size_t k = 1; k < n; k++) {
+    workers.emplace_back([&, k]{
+      uint64_t stop = k + 1 == n ? UINT64_MAX : (k + 1) * chunkSize * 8;
+      findAndDecodeChunk(deflate, k * chunkSize * 8, stop, chunks[k]);
+    });
+  }
+  chunks[0].ok = inflateFirstChunk(deflate, chunkSize * 8, out, chunks[0]);
+  for (auto& t : workers) t.join();
+  workers.clear();
+
+  // Each chunk must start where the one before it ended. A block found where
+  // there is none would show up here.
+  size_t used = 0;
+  while (true) {
+    if (!chunks[used].ok) return false;
+    if (chunks[used].last) break;
+    if (used + 1 == n || chunks[used + 1].begin != chunks[used].end) return false;
+    used++;
+  }
+  chunks.resize(used + 1);
+  if ((chunks.back().end + 7) / 8 != deflate.size()) return false;
+
+  // The window of each chunk is the end of the output before it, which takes
+  // resolving the markers in the last 32 KiB of each chunk in turn.
+  std::vector<uint8_t> window(MARKER_WINDOW);
+  uint64_t keep = std::min<uint64_t>(chunks[0].size, MARKER_WINDOW);
+  std::copy(out.end() - keep, out.end(), window.end() - keep);
+  uint64_t total = chunks[0].size;
+  for (size_t k = 1; k < chunks.size(); k++) {
+    Chunk& chunk = chunks[k];
+    chunk.window = window;
+    chunk.offset = total;
+    chunk.size = chunk.have - MARKER_WINDOW;
+    total += chunk.size;
+    keep = std::min<uint64_t>(chunk.size, MARKER_WINDOW);
+    std::copy(window.begin() + keep, window.end(), window.begin());
+    resolve(chunk.out.get() + chunk.have - keep, keep, chunk.window.data(), window.data() + MARKER_WINDOW - keep);
+  }
+
+  // Then all of the output, again in parallel.
+  out.resize(total);
+  for (size_t k = 1; k < chunks.size(); k++) {
+    workers.emplace_back([&, k]{
+      Chunk& chunk = chunks[k];
+      resolve(chunk.out.get() + MARKER_WINDOW, chunk.size, chunk.window.data(), out.data() + chunk.offset);
+      chunk.out = nullptr;
+    });
+  }
+  for (auto& t : workers) t.join();
+
+  const uint8_t* trailer = in.data() + in.size() - 8;
+  uint32_t check = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | (uint32_t(trailer[3]) << 24);
+  uint32_t isize = trailer[4] | (trailer[5] << 8) | (trailer[6] << 16) | (uint32_t(trailer[7]) << 24);
+  return isize == uint32_t(total) && check == crc32(out, threads);
+}
+
+// Input is cut into runs at the first member header at least this far into
+// it, so that small members are inflated a few at a time.
+static constexpr size_t minRunSize = 128 * 1024;
+
+size_t FindGzipMember(std::span<const uint8_t> in, size_t from) {
+  // The magic number, deflate, no reserved flags, an XFL that deflate writes
+  // and a known OS, or 255 for unknown.
+  while (from < in.size()) {
+    const uint8_t* at = static_cast<const uint8_t*>(memchr(in.data() + from, 0x1f, in.size() - from));
+    if (!at) break;
+    size_t pos = at - in.data();
+    if (in.size() - pos >= 10 && at[1] == 0x8b && at[2] == Zlib::Z_DEFLATED && (at[3] & 0xe0) == 0 &&
+        (at[8] == 0 || at[8] == 2 || at[8] == 4) && (at[9] <= 13 || at[9] == 255)) {
+      return pos;
+    }
+    from = pos + 1;
+  }
+  return in.size();
+}
+
+// One gzip member being inflated. It stays at one address, as the inflate
+// state points back at its stream.
+struct GzipMember {
+  GzipMember() {
+    int ret = inflateInit2(&strm, 31);
+    assert(ret == Zlib::Z_OK);
+  }
+  GzipMember(const GzipMember&) = delete;
+  ~GzipMember() {
+    inflateEnd(&strm);
+  }
+  Zlib::z_stream strm = {};
+};
+
+// Output of inflateMembers(), grown as needed without clearing it first.
+struct MemberOutput {
+  std::unique_ptr<uint8_t[]> data;
+  size_t size = 0, capacity = 0;
+};
+
+// Inflate the members in in, continuing the one in member if there is one,
+// and append their output to out. member is left with the member that goes on
+// past the end of in, if any. With once set, this stops after the first member
+// that ends. Sets *used to the number of bytes of in that were inflated, and
+// returns Z_OK, Z_STREAM_END if a member is followed by something that is not
+// another member, or Z_DATA_ERROR for corrupt data.
+static int inflateMembers(std::unique_ptr<GzipMember>& member, std::span<const uint8_t> in, MemberOutput& out, size_t* used, bool once) {
+  size_t pos = 0;
+  int ret = Zlib::Z_OK;
+  while (pos < in.size()) {
+    if (!member) {
+      if (in[pos] != 0x1f || (pos + 1 < in.size() && in[pos + 1] != 0x8b)) {
+        ret = Zlib::Z_STREAM_END;
+        break;
+      }
+      member = std::make_unique<GzipMember>();
+    }
+    Zlib::z_stream& strm = member->strm;
+    strm.next_in = in.data() + pos;
+    strm.avail_in = in.size() - pos;
+    do {
+      if (out.size == out.capacity) {
+        // Room for typical text to start with.
+        size_t capacity = std::max<size_t>({ 2 * out.capacity, 4 * in.size(), 65536 });
+        auto larger = std::make_unique_for_overwrite<uint8_t[]>(capacity);
+        std::copy(out.data.get(), out.data.get() + out.size, larger.get());
+        out.data = std::move(larger);
+        out.capacity = capacity;
+      }
+      strm.next_out = out.data.get() + out.size;
+      strm.avail_out = out.capacity - out.size;
+      ret = inflate(&strm, Zlib::Z_NO_FLUSH);
+      out.size = out.capacity - strm.avail_out;
+    } while (ret == Zlib::Z_OK && strm.avail_out == 0);
+    pos = in.size() - strm.avail_in;
+    // Out of input in the middle of the member.
+    if (ret == Zlib::Z_OK || ret == Zlib::Z_BUF_ERROR) {
+      ret = Zlib::Z_OK;
+      break;
+    }
+    if (ret != Zlib::Z_STREAM_END) break;
+    member = nullptr;
+    ret = Zlib::Z_OK;
+    if (once) break;
+  }
+  *used = pos;
+  return ret;
+}
+
+struct ParallelGzipDecompressorS : Decompressor {
+  // A run of input from a member header on. Its last member may go on into the
+  // next run, in which case the header that run starts at was only something
+  // that looked like one. The member is then continued through that run in
+  // order, in place of what the run decoded.
+  struct Run {
+    std::vector<uint8_t> in;
+    MemberOutput out;
+    std::unique_ptr<GzipMember> open; // member that goes on past the run
+    size_t used = 0;
+    int ret = Zlib::Z_OK;
+  };
+
+  ParallelGzipDecompressorS(size_t outputChunkSize, size_t threads)
+  : Decompressor(outputChunkSize)
+  , runs(threads, [](Run& run) { run.ret = inflateMembers(run.open, run.in, run.out, &run.used, false); }, [this](Run& run) { append(run); })
+  {}
+  std::span<uint8_t> decompress(std::span<const uint8_t> in, std::span<uint8_t> out) override {
+    if (!in.empty() && !trailing) {
+      // An open member with nothing queued behind it continues straight into
+      // the new input, up to where it ends.
+      if (open && input.empty() && runs.empty()) {
+        MemberOutput output;
+        size_t used = 0;
+        finish(inflateMembers(open, in, output, &used, true), used);
+        emit(std::move(output));
+        in = in.subspan(used);
+      }
+      if (!trailing) {
+        input.insert(input.end(), in.begin(), in.end());
+        split();
+      }
+    }
+    runs.collect(false);
+    if (trailing) input.clear();
+    if (readyBytes < out.size() && !trailing) {
+      // Output short of a full chunk says that there is no more for now, so
+      // what is left of the input cannot wait for the header after it.
+      if (!input.empty()) {
+        submit(0, input.size());
+        input.clear();
+        scanned = 0;
+      }
+      runs.collect(true);
+    }
+    return drain(out);
+  }
+  size_t bytesUsed() const override {
+    return in_used;
+  }
+
+private:
+  // Where to cut a run off the input from begin, or input.size() to wait for
+  // more. BGZF blocks say how long they are, so runs of them are cut exactly;
+  // other members are cut at the next header.
+  size_t nextCut(size_t begin) {
+    size_t end = begin;
+    while (end - begin < minRunSize) {
+      size_t size = BgzfBlockSize(input, end);
+      if (size == 0) break;
+      end += size;
+    }
+    if (end > begin) return std::min(end, input.size());
+    return FindGzipMember(input, std::max(begin + minRunSize, scanned));
+  }
+  // Cut runs off the input.
+  void split() {
+    size_t begin = 0;
+    while (!trailing) {
+      size_t next = nextCut(begin);
+      if (next == input.size()) break;
+      submit(begin, next);
+      begin = next;
+    }
+    input.erase(input.begin(), input.begin() + begin);
+    // A header needs 10 bytes, so the last 9 are looked at again later.
+    scanned = input.size() - std::min<size_t>(input.size(), 9);
+  }
+  // Hand input[begin, end) to the workers.
+  void submit(size_t begin, size_t end) {
+    Run run;
+    run.in.assign(input.begin() + begin, input.begin() + end);
+    runs.submit(std::move(run));
+  }
+  void append(Run& run) {
+    if (trailing) return;
+    if (open) {
+      MemberOutput output;
+      size_t used = 0;
+      finish(inflateMembers(open, run.in, output, &used, false), used);
+      emit(std::move(output));
+    } else {
+      emit(std::move(run.out));
+      open = std::move(run.open);
+      finish(run.ret, run.used);
+    }
+  }
+  // After the last member or corrupt data, the rest of the input is ignored.
+  void finish(int ret, size_t used) {
+    in_used += used;
+    if (ret != Zlib::Z_OK) trailing = true;
+  }
+  void emit(MemberOutput output) {
+    if (output.size == 0) return;
+    readyBytes += output.size;
+    ready.push_back(std::move(output));
+  }
+  std::span<uint8_t> drain(std::span<uint8_t> out) {
+    size_t n = 0;
+    while (n < out.size() && !ready.empty()) {
+      MemberOutput& front = ready.front();
+      size_t k = std::min(out.size() - n, front.size - readyOffset);
+      memcpy(out.data() + n, front.data.get() + readyOffset, k);
+      n += k;
+      readyOffset += k;
+      if (readyOffset == front.size) {
+        ready.pop_front();
+        readyOffset = 0;
+      }
+    }
+    readyBytes -= n;
+    return out.subspan(0, n);
+  }
+  std::vector<uint8_t> input; // not yet cut into runs, from a member header on
+  size_t scanned = 0;         // input before this has no header to cut at
+  std::unique_ptr<GzipMember> open;
+  std::deque<MemberOutput> ready; // output not yet returned
+  size_t readyOffset = 0, readyBytes = 0;
+  size_t in_used = 0;
+  bool trailing = false;
+  // Last, so that its workers stop before the rest goes.
+  OrderedPool<Run> runs;
+};
+
+std::unique_ptr<Decompressor> ParallelGzipDecompressor(size_t outputChunkSize, size_t threads) {
+  return std::make_unique<ParallelGzipDecompressorS>(outputChunkSize, threads);
+}
+
+}
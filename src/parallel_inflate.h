@@ -0,0 +1,25 @@
+#pragma once
+
+#include <decoco/decoco.hpp>
+
+namespace Decoco {
+
+// Decompresses a single-member gzip file on the given number of threads, by
+// finding deflate blocks in later parts of it and decoding them before the
+// window they refer to is known. Returns false if the data cannot be split
+// up this way, or does not decode to output that matches its trailer; a
+// sequential gunzip is then needed.
+bool ParallelGunzip(std::span<const uint8_t> in, size_t threads, std::vector<uint8_t>& out);
+
+// Returns the position of the first gzip member header at or after from, or
+// in.size() if there is none. Compressed data can look like a header, but
+// rarely does; the headers found are only ever a guess where members start.
+size_t FindGzipMember(std::span<const uint8_t> in, size_t from);
+
+// Decompresses gzip data with any number of members. Each piece of input is
+// cut into runs of whole members where headers are found, and the runs are
+// inflated on a pool of threads and returned in order. A member that goes on
+// past a cut is continued by the caller's thread.
+std::unique_ptr<Decompressor> ParallelGzipDecompressor(size_t outputChunkSize, size_t threads);
+
+}
@@ -0,0 +1,243 @@
+#include <decoco/decoco.hpp>
+#include "zlib/zlib.h"
+#include <assert.h>
+#include <algorithm>
+
+namespace Decoco {
+
+// The farthest back a deflate match can reach, and so the most output before
+// a checkpoint that decoding from it can need.
+static constexpr size_t windowSize = 32768;
+
+static bool isGzipOrZlib(std::span<const uint8_t> in) {
+  if (in.size() < 2) return false;
+  if (in[0] == 0x1F && in[1] == 0x8B) return true;
+  return (in[0] & 0xF) == 0x08 && (in[0] >> 4) <= 7 && ((in[0] << 8) | in[1]) % 31 == 0;
+}
+
+static std::vector<uint8_t> compressWindow(std::span<const uint8_t> window) {
+  // Deflate's worst case on 32 KiB, with room to spare.
+  std::vector<uint8_t> out(window.size() + window.size() / 8 + 64);
+  Zlib::z_stream strm = {};
+  int ret = deflateInit2(&strm, Zlib::Z_BEST_SPEED, Zlib::Z_DEFLATED, -15, 8, Zlib::Z_DEFAULT_STRATEGY);
+  assert(ret == Zlib::Z_OK);
+  strm.next_in = const_cast<uint8_t*>(window.data());
+  strm.avail_in = window.size();
+  strm.next_out = out.data();
+  strm.avail_out = out.size();
+  ret = deflate(&strm, Zlib::Z_FINISH);
+  assert(ret == Zlib::Z_STREAM_END);
+  out.resize(out.size() - strm.avail_out);
+  deflateEnd(&strm);
+  return out;
+}
+
+// Returns false if the window does not decompress to at most 32 KiB.
+static bool decompressWindow(std::span<const uint8_t> in, std::vector<uint8_t>& window) {
+  window.resize(windowSize);
+  Zlib::z_stream strm = {};
+  int ret = inflateInit2(&strm, -15);
+  assert(ret == Zlib::Z_OK);
+  strm.next_in = in.data();
+  strm.avail_in = in.size();
+  strm.next_out = window.data();
+  strm.avail_out = window.size();
+  ret = inflate(&strm, Zlib::Z_FINISH);
+  window.resize(window.size() - strm.avail_out);
+  inflateEnd(&strm);
+  return ret == Zlib::Z_STREAM_END;
+}
+
+DeflateIndex DeflateIndex::build(std::span<const uint8_t> in, size_t spacing) {
+  DeflateIndex index;
+  bool raw = !isGzipOrZlib(in);
+  Zlib::z_stream strm = {};
+  // 47 accepts either a gzip or a zlib header.
+  int ret = inflateInit2(&strm, raw ? -15 : 47);
+  assert(ret == Zlib::Z_OK);
+  // A raw stream starts with a block; otherwise inflate stops at the first
+  // block boundary right after the header.
+  if (raw) index.checkpoints.push_back({0, 0, {}});
+
+  std::vector<uint8_t> out(4 * windowSize);
+  std::vector<uint8_t> window(windowSize);
+  strm.next_in = in.data();
+  strm.avail_in = in.size();
+  do {
+    strm.next_out = out.data();
+    strm.avail_out = out.size();
+    // Z_BLOCK returns at the end of the header and of each block, with
+    // data_type telling the number of bits left over from the last byte read,
+    // whether that block was the last (64), and whether it is at a boundary (128).
+    ret = inflate(&strm, Zlib::Z_BLOCK);
+    if ((strm.data_type & 128) && !(strm.data_type & 64) &&
+        (index.checkpoints.empty() || strm.total_out - index.checkpoints.back().offset >= spacing)) {
+      uint64_t length = 0;
+      inflateGetDictionary(&strm, window.data(), &length);
+      index.checkpoints.push_back({strm.total_in * 8 - (strm.data_type & 63), strm.total_out,
+                                   compressWindow(std::span<const uint8_t>(window).first(length))});
+    }
+  } while (ret == Zlib::Z_OK);
+  index.size = strm.total_out;
+  inflateEnd(&strm);
+  return index;
+}
+
+// The serialized index is the magic "DCIX", followed by the decompressed size
+// and the number of checkpoints, and for each checkpoint the increase in bit
+// position and in offset from the one before, and its compressed window as
+// a length and the bytes. Numbers are LEB128 varints.
+static constexpr uint8_t indexMagic[] = { 'D', 'C', 'I', 'X' };
+
+static void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(uint8_t(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(uint8_t(value));
+}
+
+static bool getVarint(std::span<const uint8_t>& in, uint64_t& value) {
+  value = 0;
+  for (size_t shift = 0; shift < 64 && !in.empty(); shift += 7) {
+    uint8_t byte = in[0];
+    in = in.subspan(1);
+    value |= uint64_t(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+std::vector<uint8_t> DeflateIndex::serialize() const {
+  std::vector<uint8_t> out(std::begin(indexMagic), std::end(indexMagic));
+  putVarint(out, size);
+  putVarint(out, checkpoints.size());
+  uint64_t bit = 0, offset = 0;
+  for (auto& checkpoint : checkpoints) {
+    putVarint(out, checkpoint.bit - bit);
+    putVarint(out, checkpoint.offset - offset);
+    putVarint(out, checkpoint.window.size());
+    out.insert(out.end(), checkpoint.window.begin(), checkpoint.window.end());
+    bit = checkpoint.bit;
+    offset = checkpoint.offset;
+  }
+  return out;
+}
+
+DeflateIndex DeflateIndex::deserialize(std::span<const uint8_t> in) {
+  DeflateIndex index;
+  uint64_t count;
+  if (in.size() < sizeof(indexMagic) || !std::equal(std::begin(indexMagic), std::end(indexMagic), in.begin()))
+    return {};
+  in = in.subspan(sizeof(indexMagic));
+  if (!getVarint(in, index.size) || !getVarint(in, count))
+    return {};
+  uint64_t bit = 0, offset = 0;
+  for (uint64_t n = 0; n < count; n++) {
+    uint64_t bitDelta, offsetDelta, windowLength;
+    if (!getVarint(in, bitDelta) || !getVarint(in, offsetDelta) || !getVarint(in, windowLength) ||
+        windowLength > in.size())
+      return {};
+    bit += bitDelta;
+    offset += offsetDelta;
+    if (offset > index.size) return {};
+    index.checkpoints.push_back({bit, offset, std::vector<uint8_t>(in.begin(), in.begin() + windowLength)});
+    in = in.subspan(windowLength);
+  }
+  if (!in.empty()) return {};
+  return index;
+}
+
+struct SeekableDecompressor::Stream {
+  ~Stream() {
+    if (active) inflateEnd(&strm);
+  }
+  Zlib::z_stream strm = {};
+  bool active = false;
+  uint64_t offset = 0;          // of the next byte that strm produces
+  std::vector<uint8_t> scratch; // for output before the range that was asked for
+};
+
+SeekableDecompressor::SeekableDecompressor(std::span<const uint8_t> compressed, DeflateIndex index)
+: compressed(compressed)
+, idx(std::move(index))
+, stream(std::make_unique<Stream>())
+{}
+
+SeekableDecompressor::~SeekableDecompressor() = default;
+
+std::span<uint8_t> SeekableDecompressor::read(uint64_t offset, std::span<uint8_t> out) {
+  if (out.empty() || offset >= idx.size) return {};
+  auto next = std::upper_bound(idx.checkpoints.begin(), idx.checkpoints.end(), offset,
+                               [](uint64_t offset, const DeflateIndex::Checkpoint& c) { return offset < c.offset; });
+  if (next == idx.checkpoints.begin()) return {};
+  const DeflateIndex::Checkpoint& checkpoint = *(next - 1);
+  Stream& s = *stream;
+
+  // Continue the last read if that is no further from offset than the checkpoint.
+  if (!s.active || s.offset > offset || s.offset < checkpoint.offset) {
+    if (s.active) inflateEnd(&s.strm);
+    s.strm = {};
+    int ret = inflateInit2(&s.strm, -15);
+    assert(ret == Zlib::Z_OK);
+    s.active = true;
+    s.offset = checkpoint.offset;
+
+    // Start at the byte holding the checkpoint's bit, with the bits of that
+    // byte before it already dropped.
+    uint64_t byte = checkpoint.bit / 8;
+    int bits = checkpoint.bit % 8;
+    if (byte + (bits != 0) > compressed.size()) ret = Zlib::Z_DATA_ERROR;
+    if (ret == Zlib::Z_OK && bits) {
+      ret = inflatePrime(&s.strm, 8 - bits, compressed[byte] >> bits);
+      byte++;
+    }
+    if (ret == Zlib::Z_OK && !checkpoint.window.empty()) {
+      if (decompressWindow(checkpoint.window, s.scratch))
+        ret = inflateSetDictionary(&s.strm, s.scratch.data(), s.scratch.size());
+      else
+        ret = Zlib::Z_DATA_ERROR;
+    }
+    if (ret != Zlib::Z_OK) {
+      inflateEnd(&s.strm);
+      s.active = false;
+      return {};
+    }
+    s.strm.next_in = compressed.data() + byte;
+    s.strm.avail_in = compressed.size() - byte;
+  }
+
+  int ret = Zlib::Z_OK;
+  s.scratch.resize(4 * windowSize);
+  while (ret == Zlib::Z_OK && s.offset < offset) {
+    uint64_t skip = std::min<uint64_t>(offset - s.offset, s.scratch.size());
+    s.strm.next_out = s.scratch.data();
+    s.strm.avail_out = skip;
+    ret = inflate(&s.strm, Zlib::Z_NO_FLUSH);
+    s.offset += skip - s.strm.avail_out;
+  }
+  size_t used = 0;
+  if (ret == Zlib::Z_OK) {
+    s.strm.next_out = out.data();
+    s.strm.avail_out = out.size();
+    ret = inflate(&s.strm, Zlib::Z_NO_FLUSH);
+    used = out.size() - s.strm.avail_out;
+    s.offset += used;
+  }
+  // The end of the data, truncated input or corruption; a read after this
+  // starts again from a checkpoint.
+  if (ret != Zlib::Z_OK) {
+    inflateEnd(&s.strm);
+    s.active = false;
+  }
+  return out.first(used);
+}
+
+std::vector<uint8_t> SeekableDecompressor::read(uint64_t offset, size_t length) {
+  std::vector<uint8_t> out(length);
+  out.resize(read(offset, std::span<uint8_t>(out)).size());
+  return out;
+}
+
+}
+
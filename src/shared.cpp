@@ -2,49 +2,33 @@
 
 namespace Decoco {
 
+// The buffer is made the first time it is needed and kept, and is not
+// cleared, as the codec overwrites it.
+std::span<uint8_t> Compressor::buffer() {
+  if (!chunk) chunk = std::make_unique_for_overwrite<uint8_t[]>(chunkSize);
+  return { chunk.get(), chunkSize };
+}
+
 std::vector<uint8_t> Compressor::compress(std::span<const uint8_t> in) {
-  std::vector<uint8_t> chunk;
   std::vector<uint8_t> out;
-  chunk.resize(chunkSize);
-  std::span<uint8_t> compressed;
-  compressed = compress(in, chunk);
-  out.insert(out.end(), compressed.begin(), compressed.end());
-  if (compressed.size() != chunkSize) 
-    return out;
-
-  do {
-    compressed = compress({}, chunk);
-    out.insert(out.end(), compressed.begin(), compressed.end());
-  } while (compressed.size() == chunkSize);
+  compress(in, [&out](std::span<const uint8_t> piece) { out.insert(out.end(), piece.begin(), piece.end()); });
   return out;
 }
 
 std::vector<uint8_t> Compressor::flush() {
-  std::vector<uint8_t> chunk;
   std::vector<uint8_t> out;
-  chunk.resize(chunkSize);
-  std::span<uint8_t> compressed;
-  do {
-    compressed = flush(chunk);
-    out.insert(out.end(), compressed.begin(), compressed.end());
-  } while (compressed.size() == chunkSize);
+  flush([&out](std::span<const uint8_t> piece) { out.insert(out.end(), piece.begin(), piece.end()); });
   return out;
 }
 
+std::span<uint8_t> Decompressor::buffer() {
+  if (!chunk) chunk = std::make_unique_for_overwrite<uint8_t[]>(outputChunkSize);
+  return { chunk.get(), outputChunkSize };
+}
+
 std::vector<uint8_t> Decompressor::decompress(std::span<const uint8_t> in) {
-  std::vector<uint8_t> chunk;
   std::vector<uint8_t> out;
-  chunk.resize(outputChunkSize);
-  std::span<uint8_t> decompressed;
-  decompressed = decompress(in, chunk);
-  out.insert(out.end(), decompressed.begin(), decompressed.end());
-  if (decompressed.size() != outputChunkSize)
-    return out;
-
-  do {
-    decompressed = decompress({}, chunk);
-    out.insert(out.end(), decompressed.begin(), decompressed.end());
-  } while (decompressed.size() == outputChunkSize);
+  decompress(in, [&out](std::span<const uint8_t> piece) { out.insert(out.end(), piece.begin(), piece.end()); });
   return out;
 }
 
@@ -1,9 +1,14 @@
 #include <decoco/decoco.hpp>
+#include "size_hint.h"
+#include <algorithm>
+#include <cstdint>
 
+// With all of the input at hand, it is compressed in one call into room for
+// the worst case, which saves growing the output as it is made.
 std::vector<uint8_t> Decoco::compress(Decoco::Compressor& c, std::span<const uint8_t> in) {
-  std::vector<uint8_t> data = c.compress(in);
-  std::vector<uint8_t> end = c.flush();
-  data.insert(data.end(), end.begin(), end.end());
+  std::vector<uint8_t> data(c.compressBound(in.size()));
+  data.resize(c.compressInto(in, data).size());
+  if (data.size() < data.capacity() / 2) data.shrink_to_fit();
   return data;
 }
 
@@ -19,25 +24,29 @@ std::vector<uint8_t> Decoco::xzip(std::span<const uint8_t> in) {
   return compress(LzmaCompressor(), in);
 }
 
+// Some libraries count output in 32 bits, so no call is given more room than
+// that.
+static constexpr size_t maxRoom = UINT32_MAX;
+
+// Output goes straight into the vector that is returned. It starts at the
+// size the data gives, plus one byte to see that there is no more, and
+// otherwise doubles whenever it fills up. Other formats can expand further
+// than deflate, so its limit only caps the first allocation.
 std::vector<uint8_t> Decoco::decompress(Decoco::Decompressor& c, std::span<const uint8_t> in) {
-  std::vector<uint8_t> data;
-  data.resize(32768);
-  auto output = c.decompress(in, data);
-  if (output.size() != data.size()) {
-    data.resize(output.size());
-    return data;
-  }
+  uint64_t hint = std::min<uint64_t>(decompressedSizeHint(in), uint64_t(in.size()) * maxDeflateRatio);
+  std::vector<uint8_t> data(hint ? hint + 1 : 32768);
+  size_t used = 0;
   while (true) {
-    std::vector<uint8_t> nextbit;
-    nextbit.resize(32768);
-    auto output = c.decompress({}, nextbit);
-    if (output.empty()) return data;
-    data.insert(data.end(), output.begin(), output.end());
+    std::span<uint8_t> room = std::span<uint8_t>(data).subspan(used);
+    room = room.first(std::min(room.size(), maxRoom));
+    size_t got = c.decompress(used ? std::span<const uint8_t>() : in, room).size();
+    used += got;
+    if (got < room.size()) break;
+    if (used == data.size()) data.resize(data.size() * 2);
   }
-}
-
-std::vector<uint8_t> Decoco::gunzip(std::span<const uint8_t> in) {
-  return decompress(GzipDecompressor(), in);
+  data.resize(used);
+  if (data.size() < data.capacity() / 2) data.shrink_to_fit();
+  return data;
 }
 
 std::vector<uint8_t> Decoco::bunzip2(std::span<const uint8_t> in) {
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <decoco/decoco.hpp>
+
+namespace Decoco {
+
+// What the trailers, frame headers or index of each format say the data
+// decompresses to, read without decompressing anything, or 0 if the data does
+// not say or is not of that format. The data is not checked, so these are
+// hints: corrupt data can give any size.
+uint64_t GzipSizeHint(std::span<const uint8_t> in);
+uint64_t ZstdSizeHint(std::span<const uint8_t> in);
+uint64_t XzSizeHint(std::span<const uint8_t> in);
+
+// Deflate cannot expand data by more than this many times, which bounds what
+// is worth allocating up front for a size that corrupt data can claim.
+inline constexpr uint64_t maxDeflateRatio = 1032;
+
+}
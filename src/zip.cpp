@@ -0,0 +1,403 @@
+#include <decoco/decoco.hpp>
+#include "zlib/zlib.h"
+#include "ordered_pool.h"
+#include "size_hint.h"
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+namespace Decoco {
+
+// The parts of a ZIP archive, from APPNOTE.TXT: each entry is a local header
+// followed by its data, and after the entries a central directory repeats
+// the headers with the position of each. The end of central directory record
+// at the very end says where the directory is. ZIP64 records and extra fields
+// take over where a size, offset or count does not fit the original fields.
+static constexpr uint32_t localHeaderSignature = 0x04034b50;
+static constexpr uint32_t centralHeaderSignature = 0x02014b50;
+static constexpr uint32_t endSignature = 0x06054b50;
+static constexpr uint32_t zip64EndSignature = 0x06064b50;
+static constexpr uint32_t zip64LocatorSignature = 0x07064b50;
+static constexpr size_t localHeaderSize = 30;
+static constexpr size_t centralHeaderSize = 46;
+static constexpr size_t endSize = 22;
+static constexpr size_t zip64EndSize = 56;
+static constexpr size_t zip64LocatorSize = 20;
+static constexpr uint16_t zip64ExtraId = 1;
+static constexpr uint16_t methodStored = 0;
+static constexpr uint16_t methodDeflated = 8;
+static constexpr uint16_t flagEncrypted = 1;
+static constexpr uint16_t flagUtf8 = 0x800;
+// 1980-01-01 00:00, the earliest time the format has, so that an archive does
+// not depend on when it was made.
+static constexpr uint16_t dosTime = 0, dosDate = 0x21;
+
+static uint16_t get16(const uint8_t* p) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t* p) {
+  return get16(p) | (uint32_t(get16(p + 2)) << 16);
+}
+
+static uint64_t get64(const uint8_t* p) {
+  return get32(p) | (uint64_t(get32(p + 4)) << 32);
+}
+
+static void put16(std::vector<uint8_t>& out, uint16_t value) {
+  out.push_back(uint8_t(value));
+  out.push_back(uint8_t(value >> 8));
+}
+
+static void put32(std::vector<uint8_t>& out, uint32_t value) {
+  put16(out, uint16_t(value));
+  put16(out, uint16_t(value >> 16));
+}
+
+static void put64(std::vector<uint8_t>& out, uint64_t value) {
+  put32(out, uint32_t(value));
+  put32(out, uint32_t(value >> 32));
+}
+
+static int compressorLevelToZlib(Compressor::Level level) {
+  switch(level) {
+    default:
+    case Compressor::Level::Balanced: return Zlib::Z_DEFAULT_COMPRESSION;
+    case Compressor::Level::Fast: return Zlib::Z_BEST_SPEED;
+    case Compressor::Level::Small: return Zlib::Z_OPTIMAL_COMPRESSION;
+  }
+}
+
+struct ZipWriter::Pool {
+  // An entry is compressed as a whole, by a worker or by the caller.
+  struct Entry {
+    std::string name;
+    std::vector<uint8_t> data; // the input, then what goes into the archive
+    bool store = false;
+    uint16_t method = methodStored;
+    uint32_t crc = 0;
+    uint64_t size = 0;
+  };
+  // What the central directory needs of an entry once it is written.
+  struct Written {
+    std::string name;
+    uint16_t method;
+    uint32_t crc;
+    uint64_t compressedSize, size, offset;
+  };
+
+  Pool(Compressor::Level level, size_t threads)
+  : level(compressorLevelToZlib(level))
+  , jobs(threads, [this](Entry& entry) { compressEntry(entry); }, [this](Entry& entry) { append(entry); })
+  {}
+  void submit(std::string_view name, std::span<const uint8_t> data, bool store) {
+    Entry entry;
+    entry.name = name;
+    entry.data.assign(data.begin(), data.end());
+    entry.store = store;
+    jobs.submit(std::move(entry));
+  }
+  void append(const Entry& entry) {
+    Written w{entry.name, entry.method, entry.crc, entry.data.size(), entry.size, offset};
+    // A local header has the sizes in its ZIP64 field if either needs it.
+    bool zip64 = w.size >= 0xffffffff || w.compressedSize >= 0xffffffff;
+    size_t start = pending.size();
+    put32(pending, localHeaderSignature);
+    put16(pending, zip64 ? 45 : w.method == methodDeflated ? 20 : 10);
+    put16(pending, flags(w.name));
+    put16(pending, w.method);
+    put16(pending, dosTime);
+    put16(pending, dosDate);
+    put32(pending, w.crc);
+    put32(pending, zip64 ? 0xffffffff : uint32_t(w.compressedSize));
+    put32(pending, zip64 ? 0xffffffff : uint32_t(w.size));
+    put16(pending, uint16_t(w.name.size()));
+    put16(pending, zip64 ? 20 : 0);
+    pending.insert(pending.end(), w.name.begin(), w.name.end());
+    if (zip64) {
+      put16(pending, zip64ExtraId);
+      put16(pending, 16);
+      put64(pending, w.size);
+      put64(pending, w.compressedSize);
+    }
+    pending.insert(pending.end(), entry.data.begin(), entry.data.end());
+    offset += pending.size() - start;
+    written.push_back(std::move(w));
+  }
+  // Write the central directory and the records that end the archive.
+  void writeDirectory() {
+    uint64_t directoryStart = offset;
+    size_t start = pending.size();
+    for (auto& w : written) {
+      // Only the fields that do not fit go into the ZIP64 extra field.
+      std::vector<uint8_t> extra;
+      if (w.size >= 0xffffffff) put64(extra, w.size);
+      if (w.compressedSize >= 0xffffffff) put64(extra, w.compressedSize);
+      if (w.offset >= 0xffffffff) put64(extra, w.offset);
+      bool zip64 = !extra.empty();
+      put32(pending, centralHeaderSignature);
+      put16(pending, 45);
+      put16(pending, zip64 ? 45 : w.method == methodDeflated ? 20 : 10);
+      put16(pending, flags(w.name));
+      put16(pending, w.method);
+      put16(pending, dosTime);
+      put16(pending, dosDate);
+      put32(pending, w.crc);
+      put32(pending, uint32_t(std::min<uint64_t>(w.compressedSize, 0xffffffff)));
+      put32(pending, uint32_t(std::min<uint64_t>(w.size, 0xffffffff)));
+      put16(pending, uint16_t(w.name.size()));
+      put16(pending, zip64 ? uint16_t(4 + extra.size()) : 0);
+      put16(pending, 0); // comment
+      put16(pending, 0); // disk
+      put16(pending, 0); // internal attributes
+      put32(pending, 0); // external attributes
+      put32(pending, uint32_t(std::min<uint64_t>(w.offset, 0xffffffff)));
+      pending.insert(pending.end(), w.name.begin(), w.name.end());
+      if (zip64) {
+        put16(pending, zip64ExtraId);
+        put16(pending, uint16_t(extra.size()));
+        pending.insert(pending.end(), extra.begin(), extra.end());
+      }
+    }
+    uint64_t directorySize = pending.size() - start;
+    uint64_t count = written.size();
+    if (count >= 0xffff || directorySize >= 0xffffffff || directoryStart >= 0xffffffff) {
+      uint64_t zip64End = directoryStart + directorySize;
+      put32(pending, zip64EndSignature);
+      put64(pending, zip64EndSize - 12);
+      put16(pending, 45);
+      put16(pending, 45);
+      put32(pending, 0); // disk
+      put32(pending, 0); // disk with the directory
+      put64(pending, count);
+      put64(pending, count);
+      put64(pending, directorySize);
+      put64(pending, directoryStart);
+      put32(pending, zip64LocatorSignature);
+      put32(pending, 0); // disk with the ZIP64 end record
+      put64(pending, zip64End);
+      put32(pending, 1); // disks
+    }
+    put32(pending, endSignature);
+    put16(pending, 0); // disk
+    put16(pending, 0); // disk with the directory
+    put16(pending, uint16_t(std::min<uint64_t>(count, 0xffff)));
+    put16(pending, uint16_t(std::min<uint64_t>(count, 0xffff)));
+    put32(pending, uint32_t(std::min<uint64_t>(directorySize, 0xffffffff)));
+    put32(pending, uint32_t(std::min<uint64_t>(directoryStart, 0xffffffff)));
+    put16(pending, 0); // comment
+    written.clear();
+  }
+  static uint16_t flags(const std::string& name) {
+    // Names that are not plain ASCII are marked as UTF-8.
+    bool ascii = std::all_of(name.begin(), name.end(), [](char c) { return (c & 0x80) == 0; });
+    return ascii ? 0 : flagUtf8;
+  }
+  // Deflate the entry, or keep it stored if asked to or if deflate does not
+  // make it smaller.
+  void compressEntry(Entry& entry) const {
+    entry.size = entry.data.size();
+    entry.crc = Zlib::crc32(0, entry.data.data(), entry.data.size());
+    if (entry.store || entry.data.empty()) return;
+    std::vector<uint8_t> out(entry.data.size());
+    Zlib::z_stream strm = {};
+    int ret = deflateInit2(&strm, level, Zlib::Z_DEFLATED, -Zlib::MAX_WBITS, 8, Zlib::Z_DEFAULT_STRATEGY);
+    assert(ret == Zlib::Z_OK);
+    strm.next_in = entry.data.data();
+    strm.avail_in = entry.data.size();
+    strm.next_out = out.data();
+    strm.avail_out = out.size();
+    ret = deflate(&strm, Zlib::Z_FINISH);
+    deflateEnd(&strm);
+    if (ret != Zlib::Z_STREAM_END || strm.avail_out == 0) return;
+    out.resize(out.size() - strm.avail_out);
+    entry.data = std::move(out);
+    entry.method = methodDeflated;
+  }
+  std::vector<uint8_t> take() {
+    std::vector<uint8_t> out;
+    std::swap(out, pending);
+    return out;
+  }
+
+  int level;
+  std::vector<uint8_t> pending; // archive not yet returned
+  uint64_t offset = 0;          // of the next entry in the archive
+  std::vector<Written> written;
+  bool closed = false;
+  // Last, so that its workers stop before the rest goes.
+  OrderedPool<Entry> jobs;
+};
+
+ZipWriter::ZipWriter(Compressor::Level level, size_t threads)
+: pool(std::make_unique<Pool>(level, threads))
+{}
+
+ZipWriter::~ZipWriter() = default;
+
+std::vector<uint8_t> ZipWriter::add(std::string_view name, std::span<const uint8_t> data, Method method) {
+  assert(!pool->closed);
+  pool->submit(name, data, method == Method::Stored);
+  return pool->take();
+}
+
+std::vector<uint8_t> ZipWriter::finish() {
+  if (pool->closed) return {};
+  pool->jobs.collect(true);
+  pool->writeDirectory();
+  pool->closed = true;
+  return pool->take();
+}
+
+// Where the end of central directory record starts, or archive.size() if there
+// is none. It is last, but may be followed by a comment of up to 64 KiB.
+static size_t findEnd(std::span<const uint8_t> archive) {
+  if (archive.size() < endSize) return archive.size();
+  size_t lowest = archive.size() - std::min(archive.size(), endSize + 0xffff);
+  for (size_t pos = archive.size() - endSize + 1; pos-- > lowest;) {
+    const uint8_t* p = archive.data() + pos;
+    if (get32(p) == endSignature && pos + endSize + get16(p + 20) == archive.size()) return pos;
+  }
+  return archive.size();
+}
+
+// The entries of the central directory, in order and by name.
+struct ZipReader::Index {
+  // Read the central directory into list and byName. Returns false if it is
+  // not there or is corrupt.
+  bool load(std::span<const uint8_t> archive);
+
+  std::vector<Entry> list;
+  std::unordered_map<std::string_view, size_t> byName;
+};
+
+ZipReader::ZipReader(std::span<const uint8_t> archive)
+: archive(archive)
+, index(std::make_unique<Index>())
+{
+  if (!index->load(archive)) {
+    index->list.clear();
+    index->byName.clear();
+  }
+}
+
+ZipReader::ZipReader(ZipReader&&) noexcept = default;
+ZipReader& ZipReader::operator=(ZipReader&&) noexcept = default;
+ZipReader::~ZipReader() = default;
+
+bool ZipReader::Index::load(std::span<const uint8_t> archive) {
+  size_t end = findEnd(archive);
+  if (end == archive.size()) return false;
+  const uint8_t* e = archive.data() + end;
+  uint64_t count = get16(e + 10), directorySize = get32(e + 12), directoryStart = get32(e + 16);
+  if (end >= zip64LocatorSize && get32(e - zip64LocatorSize) == zip64LocatorSignature) {
+    uint64_t zip64End = get64(e - zip64LocatorSize + 8);
+    if (archive.size() < zip64EndSize || zip64End > archive.size() - zip64EndSize || get32(archive.data() + zip64End) != zip64EndSignature) return false;
+    const uint8_t* z = archive.data() + zip64End;
+    count = get64(z + 32);
+    directorySize = get64(z + 40);
+    directoryStart = get64(z + 48);
+  }
+  if (directoryStart > archive.size() || archive.size() - directoryStart < directorySize) return false;
+  // Every entry takes at least a central header, which bounds a bogus count.
+  if (count > directorySize / centralHeaderSize) return false;
+
+  std::span<const uint8_t> directory = archive.subspan(directoryStart, directorySize);
+  list.reserve(count);
+  byName.reserve(count);
+  size_t pos = 0;
+  for (uint64_t n = 0; n < count; n++) {
+    if (directory.size() - pos < centralHeaderSize) return false;
+    const uint8_t* h = directory.data() + pos;
+    size_t nameSize = get16(h + 28), extraSize = get16(h + 30), commentSize = get16(h + 32);
+    if (get32(h) != centralHeaderSignature || directory.size() - pos < centralHeaderSize + nameSize + extraSize + commentSize) return false;
+    Entry entry;
+    entry.name = std::string_view(reinterpret_cast<const char*>(h + centralHeaderSize), nameSize);
+    entry.flags = get16(h + 8);
+    entry.method = get16(h + 10);
+    entry.crc = get32(h + 16);
+    entry.compressedSize = get32(h + 20);
+    entry.size = get32(h + 24);
+    entry.offset = get32(h + 42);
+    // Fields that are all ones are in the ZIP64 extra field, in this order.
+    const uint8_t* extra = h + centralHeaderSize + nameSize;
+    for (size_t at = 0; at + 4 <= extraSize;) {
+      size_t fieldSize = get16(extra + at + 2);
+      if (at + 4 + fieldSize > extraSize) break;
+      if (get16(extra + at) == zip64ExtraId) {
+        const uint8_t* field = extra + at + 4;
+        const uint8_t* fieldEnd = field + fieldSize;
+        for (uint64_t* value : { &entry.size, &entry.compressedSize, &entry.offset }) {
+          if (*value != 0xffffffff) continue;
+          if (fieldEnd - field < 8) return false;
+          *value = get64(field);
+          field += 8;
+        }
+      }
+      at += 4 + fieldSize;
+    }
+    byName.emplace(entry.name, list.size());
+    list.push_back(entry);
+    pos += centralHeaderSize + nameSize + extraSize + commentSize;
+  }
+  return true;
+}
+
+const std::vector<ZipReader::Entry>& ZipReader::entries() const {
+  return index->list;
+}
+
+const ZipReader::Entry* ZipReader::find(std::string_view name) const {
+  auto it = index->byName.find(name);
+  return it == index->byName.end() ? nullptr : &index->list[it->second];
+}
+
+std::span<const uint8_t> ZipReader::raw(const Entry& entry) const {
+  if (entry.offset > archive.size() || archive.size() - entry.offset < localHeaderSize) return {};
+  const uint8_t* h = archive.data() + entry.offset;
+  if (get32(h) != localHeaderSignature) return {};
+  // The local header can have other extra fields than the central one.
+  uint64_t start = entry.offset + localHeaderSize + get16(h + 26) + get16(h + 28);
+  if (start > archive.size() || archive.size() - start < entry.compressedSize) return {};
+  return archive.subspan(start, entry.compressedSize);
+}
+
+bool ZipReader::read(const Entry& entry, std::span<uint8_t> out) const {
+  if (out.size() != entry.size || (entry.flags & flagEncrypted)) return false;
+  std::span<const uint8_t> in = raw(entry);
+  if (in.size() != entry.compressedSize) return false;
+  if (entry.method == methodStored) {
+    if (in.size() != out.size()) return false;
+    if (!in.empty()) memcpy(out.data(), in.data(), in.size());
+  } else if (entry.method == methodDeflated) {
+    // The size is known, so inflate writes straight into out without a window.
+    Zlib::z_stream strm = {};
+    int ret = inflateInit2(&strm, -Zlib::MAX_WBITS);
+    assert(ret == Zlib::Z_OK);
+    inflateNoWindow(&strm);
+    uint8_t none;
+    strm.next_in = in.data();
+    strm.avail_in = in.size();
+    strm.next_out = out.empty() ? &none : out.data();
+    strm.avail_out = out.empty() ? 1 : out.size();
+    ret = inflate(&strm, Zlib::Z_FINISH);
+    bool ok = ret == Zlib::Z_STREAM_END && strm.total_out == out.size();
+    inflateEnd(&strm);
+    if (!ok) return false;
+  } else {
+    return false;
+  }
+  return Zlib::crc32(0, out.data(), out.size()) == entry.crc;
+}
+
+std::vector<uint8_t> ZipReader::read(const Entry& entry) const {
+  // A corrupt directory can claim any size; deflate bounds it.
+  if (entry.size / maxDeflateRatio > entry.compressedSize + 1) return {};
+  auto out = std::vector<uint8_t>(entry.size);
+  if (!read(entry, out)) return {};
+  return out;
+}
+
+}
@@ -1,5 +1,6 @@
 #include <decoco/decoco.hpp>
 #include "zlib/zlib.h"
+#include "parallel_deflate.h"
 #include <assert.h>
 
 namespace Decoco {
@@ -10,7 +11,7 @@ struct ZlibCompressorS : Compressor {
       default: 
       case Compressor::Level::Balanced: return Zlib::Z_DEFAULT_COMPRESSION;
       case Compressor::Level::Fast: return Zlib::Z_BEST_SPEED;
-      case Compressor::Level::Small: return Zlib::Z_BEST_COMPRESSION;
+      case Compressor::Level::Small: return Zlib::Z_OPTIMAL_COMPRESSION;
     }
   }
   ZlibCompressorS(Compressor::Level level, size_t chunkSize)
@@ -40,13 +41,35 @@ struct ZlibCompressorS : Compressor {
     assert(ret != Zlib::Z_STREAM_ERROR);
     return out.subspan(0, out.size() - strm.avail_out);
   }
+  size_t compressBound(size_t size) const override {
+    return Zlib::deflateBound(const_cast<Zlib::z_stream*>(&strm), size);
+  }
+  std::span<uint8_t> compressInto(std::span<const uint8_t> in, std::span<uint8_t> out) override {
+    // deflate() does nothing without room for output.
+    if (out.empty()) return {};
+    if (strm.total_in || strm.total_out) Zlib::deflateReset(&strm);
+    strm.avail_in = in.size();
+    strm.next_in = const_cast<uint8_t*>(in.data());
+    strm.avail_out = out.size();
+    strm.next_out = out.data();
+    int ret = deflate(&strm, Zlib::Z_FINISH);
+    assert(ret != Zlib::Z_STREAM_ERROR);
+    if (ret != Zlib::Z_STREAM_END) return {};
+    return out.subspan(0, out.size() - strm.avail_out);
+  }
   ~ZlibCompressorS() {
     deflateEnd(&strm);
   }
   Zlib::z_stream strm;
 };
 
-std::unique_ptr<Compressor> ZlibCompressor(Compressor::Level level, size_t chunkSize) { return std::make_unique<ZlibCompressorS>(level, chunkSize); }
+std::unique_ptr<Compressor> ZlibCompressor(Compressor::Level level, size_t chunkSize) {
+  return std::make_unique<ZlibCompressorS>(level, chunkSize);
+}
+
+std::unique_ptr<Compressor> ZlibCompressor(Compressor::Level level, size_t chunkSize, size_t threads) {
+  return ParallelDeflateCompressor(DeflateWrapper::Zlib, ZlibCompressorS::compressorLevelToZlib(level), chunkSize, threads);
+}
 
 struct ZlibDecompressorS : Decompressor {
   ZlibDecompressorS(size_t outputChunkSize)
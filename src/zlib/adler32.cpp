@@ -4,17 +4,20 @@
  */
 
 #include "zutil.h"
+#include "cpu_features.h"
 
 namespace Zlib {
 
 constexpr size_t BASE = 65521U;     /* largest prime smaller than 65536 */
 constexpr size_t NMAX = 5552; /* NMAX is the largest n such that 255n(n+1)/2 + (n+1)(BASE-1) <= 2^32-1 */
 
-uint32_t adler32(uint32_t adler, const uint8_t* buf, size_t len)
+/* Like all the kernels here, also copy the bytes to dst on the way, unless
+ * dst is null, so that data that is copied anyway is only read once. This one
+ * copies a stretch of up to NMAX bytes at a time and sums the copy, which is
+ * still in cache.
+ */
+static uint32_t adler32_c(uint32_t adler, uint8_t* dst, const uint8_t* buf, size_t len)
 {
-    if (buf == nullptr)
-        return 1;
-
     /* split Adler-32 into component sums */
     uint32_t sum2 = (adler >> 16) & 0xffff;
     adler &= 0xffff;
@@ -27,8 +30,15 @@ uint32_t adler32(uint32_t adler, const uint8_t* buf, size_t len)
         else 
           n = NMAX;
         len -= n;
+        const uint8_t* p = buf;
+        buf += n;
+        if (dst) {
+            memcpy(dst, p, n);
+            p = dst;
+            dst += n;
+        }
         do {
-            adler += *buf++; sum2 += adler;
+            adler += *p++; sum2 += adler;
         } while (--n);
         adler %= BASE;
         sum2 %= BASE;
@@ -38,6 +48,167 @@ uint32_t adler32(uint32_t adler, const uint8_t* buf, size_t len)
     return adler | (sum2 << 16);
 }
 
+#ifdef ZLIB_X86
+/* The SIMD versions take 32 bytes at a time. For a block of bytes b[0..31],
+ * s1 grows by the sum of the bytes and s2 by 32 times the s1 before the
+ * block plus the sum of b[i] * (32 - i). The first sum comes from psadbw,
+ * the second from pmaddubsw against the taps 32..1. The s1 before each block
+ * is accumulated in ps and multiplied by 32 at the end. Up to NMAX bytes go
+ * by before the sums are reduced; lanes may wrap, but the totals cannot.
+ */
+#define S23O1 _MM_SHUFFLE(2,3,0,1)  /* A B C D -> B A D C */
+#define S1O32 _MM_SHUFFLE(1,0,3,2)  /* A B C D -> C D A B */
+
+__attribute__((target("ssse3")))
+static uint32_t adler32_ssse3(uint32_t adler, uint8_t* dst, const uint8_t* buf, size_t len)
+{
+    constexpr size_t BLOCK_SIZE = 32;
+    uint32_t s1 = adler & 0xffff;
+    uint32_t s2 = adler >> 16;
+    size_t blocks = len / BLOCK_SIZE;
+    len -= blocks * BLOCK_SIZE;
+
+    const __m128i tap1 = _mm_setr_epi8(32,31,30,29,28,27,26,25,24,23,22,21,20,19,18,17);
+    const __m128i tap2 = _mm_setr_epi8(16,15,14,13,12,11,10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+
+    while (blocks) {
+        uint32_t n = NMAX / BLOCK_SIZE;
+        if (n > blocks) n = (uint32_t)blocks;
+        blocks -= n;
+
+        __m128i v_ps = _mm_setr_epi32((int)(s1 * n), 0, 0, 0);
+        __m128i v_s2 = _mm_setr_epi32((int)s2, 0, 0, 0);
+        __m128i v_s1 = zero;
+
+        do {
+            const __m128i bytes1 = _mm_loadu_si128((const __m128i *)buf);
+            const __m128i bytes2 = _mm_loadu_si128((const __m128i *)(buf + 16));
+            if (dst) {
+                _mm_storeu_si128((__m128i *)dst, bytes1);
+                _mm_storeu_si128((__m128i *)(dst + 16), bytes2);
+                dst += BLOCK_SIZE;
+            }
+
+            v_ps = _mm_add_epi32(v_ps, v_s1);
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+            buf += BLOCK_SIZE;
+        } while (--n);
+
+        v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, S1O32));
+        s1 += (uint32_t)_mm_cvtsi128_si32(v_s1);
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, S23O1));
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, S1O32));
+        s2 = (uint32_t)_mm_cvtsi128_si32(v_s2);
+
+        s1 %= BASE;
+        s2 %= BASE;
+    }
+    return adler32_c(s1 | (s2 << 16), dst, buf, len);
+}
+
+__attribute__((target("avx2")))
+static uint32_t adler32_avx2(uint32_t adler, uint8_t* dst, const uint8_t* buf, size_t len)
+{
+    constexpr size_t BLOCK_SIZE = 32;
+    uint32_t s1 = adler & 0xffff;
+    uint32_t s2 = adler >> 16;
+    size_t blocks = len / BLOCK_SIZE;
+    len -= blocks * BLOCK_SIZE;
+
+    const __m256i tap = _mm256_setr_epi8(32,31,30,29,28,27,26,25,24,23,22,21,20,19,18,17,
+                                         16,15,14,13,12,11,10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+
+    while (blocks) {
+        uint32_t n = NMAX / BLOCK_SIZE;
+        if (n > blocks) n = (uint32_t)blocks;
+        blocks -= n;
+
+        __m256i v_ps = _mm256_setr_epi32((int)(s1 * n), 0, 0, 0, 0, 0, 0, 0);
+        __m256i v_s2 = _mm256_setr_epi32((int)s2, 0, 0, 0, 0, 0, 0, 0);
+        __m256i v_s1 = zero;
+
+        do {
+            const __m256i bytes = _mm256_loadu_si256((const __m256i *)buf);
+            if (dst) {
+                _mm256_storeu_si256((__m256i *)dst, bytes);
+                dst += BLOCK_SIZE;
+            }
+
+            v_ps = _mm256_add_epi32(v_ps, v_s1);
+            v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(bytes, zero));
+            v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, tap), ones));
+            buf += BLOCK_SIZE;
+        } while (--n);
+
+        v_s2 = _mm256_add_epi32(v_s2, _mm256_slli_epi32(v_ps, 5));
+
+        __m128i h1 = _mm_add_epi32(_mm256_castsi256_si128(v_s1), _mm256_extracti128_si256(v_s1, 1));
+        h1 = _mm_add_epi32(h1, _mm_shuffle_epi32(h1, S1O32));
+        s1 += (uint32_t)_mm_cvtsi128_si32(h1);
+        __m128i h2 = _mm_add_epi32(_mm256_castsi256_si128(v_s2), _mm256_extracti128_si256(v_s2, 1));
+        h2 = _mm_add_epi32(h2, _mm_shuffle_epi32(h2, S23O1));
+        h2 = _mm_add_epi32(h2, _mm_shuffle_epi32(h2, S1O32));
+        s2 = (uint32_t)_mm_cvtsi128_si32(h2);
+
+        s1 %= BASE;
+        s2 %= BASE;
+    }
+    return adler32_c(s1 | (s2 << 16), dst, buf, len);
+}
+#endif
+
+typedef uint32_t (*adler_func) (uint32_t adler, uint8_t* dst, const uint8_t* buf, size_t len);
+
+static const kernel_variant adler32_variants[] = {
+#ifdef ZLIB_X86
+    { "avx2",  CPU_AVX2,  (kernel_fn)adler32_avx2 },
+    { "ssse3", CPU_SSSE3, (kernel_fn)adler32_ssse3 },
+#endif
+    { "c",     0,         (kernel_fn)adler32_c },
+};
+
+kernel adler32_kernel = { "adler32", adler32_variants, sizeof(adler32_variants) / sizeof(adler32_variants[0]), {} };
+
+uint32_t adler32(uint32_t adler, const uint8_t* buf, size_t len)
+{
+    if (buf == nullptr)
+        return 1;
+    return kernel_get<adler_func>(&adler32_kernel)(adler, nullptr, buf, len);
+}
+
+uint32_t adler32_copy(uint32_t adler, uint8_t* dst, const uint8_t* src, size_t len)
+{
+    return kernel_get<adler_func>(&adler32_kernel)(adler, dst, src, len);
+}
+
+/* ========================================================================= */
+uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, uint64_t len2)
+{
+    uint32_t sum1;
+    uint32_t sum2;
+    uint32_t rem;
+
+    /* the derivation of this formula is left as an exercise for the reader */
+    rem = (uint32_t)(len2 % BASE);
+    sum1 = adler1 & 0xffff;
+    sum2 = (uint32_t)((uint64_t)rem * sum1 % BASE);
+    sum1 += (adler2 & 0xffff) + BASE - 1;
+    sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + BASE - rem;
+    if (sum1 >= BASE) sum1 -= BASE;
+    if (sum1 >= BASE) sum1 -= BASE;
+    if (sum2 >= (BASE << 1)) sum2 -= (BASE << 1);
+    if (sum2 >= BASE) sum2 -= BASE;
+    return sum1 | (sum2 << 16);
 }
 
+}
 
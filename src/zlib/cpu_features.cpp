@@ -0,0 +1,97 @@
+/* cpu_features.c -- runtime detection of optional instruction set extensions
+ * and selection of the kernel variants that use them
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#include "cpu_features.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace Zlib {
+
+static uint32_t cpu_detect()
+{
+    uint32_t f = 0;
+#ifdef ZLIB_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))   f |= CPU_SSE2;
+    if (__builtin_cpu_supports("ssse3"))  f |= CPU_SSSE3;
+    if (__builtin_cpu_supports("sse4.2")) f |= CPU_SSE42;
+    if (__builtin_cpu_supports("pclmul")) f |= CPU_PCLMULQDQ;
+    if (__builtin_cpu_supports("avx2"))   f |= CPU_AVX2;
+    if (__builtin_cpu_supports("bmi2"))   f |= CPU_BMI2;
+#endif
+    return f;
+}
+
+uint32_t cpu_get_features()
+{
+    static const uint32_t features = cpu_detect();
+    return features;
+}
+
+kernel *const kernels[] = {
+    &crc32_kernel,
+    &adler32_kernel,
+    &longest_match_kernel,
+    &slide_hash_kernel,
+    &inflate_fast_kernel,
+};
+const size_t kernel_count = sizeof(kernels) / sizeof(kernels[0]);
+
+bool kernel_supported(const kernel_variant *v)
+{
+    return (v->needs & ~cpu_get_features()) == 0;
+}
+
+/* ===========================================================================
+ * Return the variant of k that DECOCO_KERNELS asks for, if any.
+ */
+static const kernel_variant *kernel_from_env(const kernel *k)
+{
+    const kernel_variant *found = nullptr;
+    const char *p = getenv("DECOCO_KERNELS");
+    if (p == nullptr) return nullptr;
+
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        const char *eq = (const char *)memchr(p, '=', len);
+        const char *variant = p;
+        size_t vlen = len;
+        if (eq) {
+            size_t klen = (size_t)(eq - p);
+            variant = eq + 1;
+            vlen = len - klen - 1;
+            if (klen != strlen(k->name) || memcmp(p, k->name, klen) != 0) variant = nullptr;
+        }
+        for (size_t i = 0; variant && i < k->count; i++) {
+            if (strlen(k->variants[i].name) == vlen && memcmp(k->variants[i].name, variant, vlen) == 0)
+                found = &k->variants[i];
+        }
+        p += len;
+        if (*p == ',') p++;
+    }
+    return found;
+}
+
+const kernel_variant *kernel_resolve(kernel *k)
+{
+    const kernel_variant *v = kernel_from_env(k);
+    if (v == nullptr || !kernel_supported(v)) {
+        for (v = k->variants; !kernel_supported(v); v++) {}
+    }
+
+    /* Another thread may have got here first. */
+    const kernel_variant *expected = nullptr;
+    if (!k->active.compare_exchange_strong(expected, v, std::memory_order_acq_rel))
+        return expected;
+    return v;
+}
+
+void kernel_set(kernel *k, const kernel_variant *v)
+{
+    k->active.store(v, std::memory_order_release);
+    if (v == nullptr) kernel_resolve(k);
+}
+
+}
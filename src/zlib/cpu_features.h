@@ -0,0 +1,95 @@
+/* cpu_features.h -- runtime detection of optional instruction set extensions
+ * and selection of the kernel variants that use them
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+/* WARNING: this file should *not* be used by applications. It is
+   part of the implementation of the compression library and is
+   subject to change. Applications should only use zlib.h.
+ */
+
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define ZLIB_X86 1
+#  include <immintrin.h>
+#endif
+
+namespace Zlib {
+
+enum CpuFeature : uint32_t {
+    CPU_SSE2      = 1 << 0,
+    CPU_SSSE3     = 1 << 1,
+    CPU_SSE42     = 1 << 2,
+    CPU_PCLMULQDQ = 1 << 3,
+    CPU_AVX2      = 1 << 4,
+    CPU_BMI2      = 1 << 5,
+};
+
+/* Features of the CPU we are running on as CPU_* bits, detected once on
+ * first use.
+ */
+uint32_t cpu_get_features();
+
+typedef void (*kernel_fn)();
+
+/* One implementation of a kernel and the CPU features it needs. */
+typedef struct kernel_variant_s {
+    const char *name;
+    uint32_t    needs;
+    kernel_fn   fn;
+} kernel_variant;
+
+/* A hot function with implementations for several instruction sets, listed
+ * best first; the last one runs anywhere. The variant in use is the best one
+ * the CPU supports, unless another one is forced with kernel_set() or with
+ * the DECOCO_KERNELS environment variable. That holds a comma-separated list
+ * of kernel=variant pairs; a variant name on its own applies to every kernel
+ * that has it, so DECOCO_KERNELS=c runs the portable code throughout.
+ */
+typedef struct kernel_s {
+    const char *name;
+    const kernel_variant *variants;
+    size_t count;
+    std::atomic<const kernel_variant *> active;
+} kernel;
+
+/* Pick the variant k starts out with, on first use. */
+const kernel_variant *kernel_resolve(kernel *k);
+
+/* The function of the active variant of k. */
+template <typename F>
+inline F kernel_get(kernel *k)
+{
+    const kernel_variant *v = k->active.load(std::memory_order_acquire);
+    if (v == nullptr) v = kernel_resolve(k);
+    return reinterpret_cast<F>(v->fn);
+}
+
+/* Whether the running CPU can execute v. */
+bool kernel_supported(const kernel_variant *v);
+
+/* Use v for k from now on, or go back to the default choice if v is null.
+ * v must be supported. Streams that already picked up a variant (such as
+ * longest_match, chosen in deflateInit) keep using it.
+ */
+void kernel_set(kernel *k, const kernel_variant *v);
+
+extern kernel crc32_kernel;
+extern kernel adler32_kernel;
+extern kernel longest_match_kernel;
+extern kernel slide_hash_kernel;
+extern kernel inflate_fast_kernel;
+
+/* All of the above, for reporting and lookup by name. */
+extern kernel *const kernels[];
+extern const size_t kernel_count;
+
+}
+
+#endif /* CPU_FEATURES_H */
@@ -51,6 +51,7 @@
 
 #include <cstdio>
 #include "deflate.h"
+#include "cpu_features.h"
 
 /*
   If you use the zlib library in a product, an acknowledgment is welcome
@@ -74,24 +75,30 @@ typedef enum {
 typedef block_state (*compress_func) (deflate_state *s, int flush);
 /* Compression function. Returns the block state after the call. */
 
+typedef void (*slide_func) (Pos *table, uint32_t n, uint32_t wsize);
+/* Slide the positions in a hash table down by wsize, clamping at zero. */
+
 static int deflateStateCheck      (z_stream* strm);
 static void slide_hash     (deflate_state *s);
 static void fill_window    (deflate_state *s);
+static block_state deflate_fast   (deflate_state *s, int flush);
 static block_state deflate_slow   (deflate_state *s, int flush);
+static block_state deflate_optimal(deflate_state *s, int flush);
+static int  opt_alloc      (deflate_state *s);
+static void opt_free       (deflate_state *s);
+static void opt_reset      (deflate_state *s);
 static block_state deflate_rle    (deflate_state *s, int flush);
 static block_state deflate_huff   (deflate_state *s, int flush);
 static void lm_init        (deflate_state *s);
 static void putShortMSB    (deflate_state *s, uint16_t b);
 static void flush_pending  (z_stream* strm);
 static size_t read_buf(z_stream* strm, uint8_t* buf, size_t size);
-static uint64_t longest_match  (deflate_state *s, IPos cur_match);
-static int deflateReset (z_stream* strm);
 
 static int            deflateResetKeep (z_stream*);
 
 
 /* Values for max_lazy_match, good_match and max_chain_length, depending on
- * the desired pack level (0..9). The values given below have been tuned to
+ * the desired pack level (0..10). The values given below have been tuned to
  * exclude worst case performance for pathological files. Better values may be
  * found for specific files.
  */
@@ -103,19 +110,20 @@ typedef struct config_s {
    compress_func func;
 } config;
 
-// Given computer advances, remove all fast/store only things.
-static const config configuration_table[10] = {
+// Given computer advances, remove all store only things.
+static const config configuration_table[11] = {
 /*      good lazy nice chain */
 /* 0 */ {4,    4, 16,   16, deflate_slow},  /* lazy matches */
-/* 1 */ {4,    4, 16,   16, deflate_slow},  /* lazy matches */
-/* 2 */ {4,    4, 16,   16, deflate_slow},  /* lazy matches */
-/* 3 */ {4,    4, 16,   16, deflate_slow},  /* lazy matches */
+/* 1 */ {4,    4,  8,    4, deflate_fast},  /* max speed, no lazy matches */
+/* 2 */ {4,    5, 16,    8, deflate_fast},
+/* 3 */ {4,    6, 32,   32, deflate_fast},
 /* 4 */ {4,    4, 16,   16, deflate_slow},  /* lazy matches */
 /* 5 */ {8,   16, 32,   32, deflate_slow},
 /* 6 */ {8,   16, 128, 128, deflate_slow},
 /* 7 */ {8,   32, 128, 256, deflate_slow},
 /* 8 */ {32, 128, 258, 1024, deflate_slow},
-/* 9 */ {32, 258, 258, 4096, deflate_slow}}; /* max compression */
+/* 9 */ {32, 258, 258, 4096, deflate_slow},  /* max compression */
+/* 10 */{32, 258, 258, 4096, deflate_optimal}}; /* optimal parsing */
 
 /* Note: the deflate() code requires max_lazy >= MIN_MATCH and max_chain >= 4
  * For deflate_fast() (levels <= 3) good is ignored and lazy has a different
@@ -126,28 +134,72 @@ static const config configuration_table[10] = {
 #define RANK(f) (((f) * 2) - ((f) > 4 ? 9 : 0))
 
 /* ===========================================================================
- * Update a hash value with the given input byte
- * IN  assertion: all calls to UPDATE_HASH are made with consecutive input
- *    characters, so that a running hash key can be computed from the previous
- *    key instead of complete recalculation each time.
+ * Load 4 bytes as a little-endian value, so that hash keys (and thereby the
+ * compressed output) do not depend on the byte order of the machine.
+ */
+static inline uint32_t load32_le(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+/* ===========================================================================
+ * Hash the HASH_BYTES bytes at window[str]. This is a multiplicative hash of
+ * a single unaligned load; unlike a rolling hash it needs no state carried
+ * from the previous position, so strings can be inserted in any order and
+ * consecutive insertions do not depend on each other.
+ * hash_shift is 32 - hash_bits, keeping the well-mixed top bits.
  */
-#define UPDATE_HASH(s,h,c) (h = (((h)<<s->hash_shift) ^ (c)) & s->hash_mask)
+#define HASH_MULT 2654435761u
+#define HASH(s, str) \
+    ((load32_le((s)->window + (str)) * HASH_MULT) >> (s)->hash_shift)
 
+/* Hash of the first MIN_MATCH bytes at window[str], for the head3 table. */
+#define HASH3(s, str) \
+    (((load32_le((s)->window + (str)) & 0xffffff) * HASH_MULT) >> (32 - HASH3_BITS))
 
 /* ===========================================================================
  * Insert string str in the dictionary and set match_head to the previous head
- * of the hash chain (the most recent string with same hash key). Return
- * the previous length of the hash chain.
- * If this file is compiled with -DFASTEST, the compression level is forced
- * to 1, and no hash chains are maintained.
- * IN  assertion: all calls to INSERT_STRING are made with consecutive input
- *    characters and the first MIN_MATCH bytes of str are valid (except for
- *    the last MIN_MATCH-1 bytes of the input file).
+ * of the hash chain (the most recent string with same hash key).
+ * IN  assertion: the first HASH_BYTES bytes of str are valid.
  */
 #define INSERT_STRING(s, str, match_head) \
-   (UPDATE_HASH(s, s->ins_h, s->window[(str) + (MIN_MATCH-1)]), \
-    match_head = s->prev[(str) & s->w_mask] = s->head[s->ins_h], \
-    s->head[s->ins_h] = (Pos)(str))
+   { uint32_t h_ = HASH(s, str); \
+     match_head = s->prev[(str) & s->w_mask] = s->head[h_]; \
+     s->head[h_] = (Pos)(str); }
+
+/* ===========================================================================
+ * Record str as the most recent string with its first MIN_MATCH bytes, and
+ * set match_head to the previous one. Only the lazy matcher uses head3, to
+ * find the 3-byte matches that the 4-byte hash chains cannot see.
+ */
+#define INSERT_STRING3(s, str, match_head) \
+   { uint32_t h_ = HASH3(s, str); \
+     match_head = s->head3[h_]; \
+     s->head3[h_] = (Pos)(str); }
+
+/* ===========================================================================
+ * Insert count consecutive strings starting at str, e.g. the positions
+ * skipped over by a match. With with3 the head3 table is updated as well.
+ * IN  assertion: the first HASH_BYTES bytes of the last string are valid.
+ */
+template <bool with3>
+static inline void insert_strings(deflate_state* s, uint32_t str, uint32_t count)
+{
+    Pos *prev = s->prev, *head = s->head;
+    uint32_t wmask = s->w_mask;
+
+    for (uint32_t end = str + count; str != end; str++) {
+        uint32_t h = HASH(s, str);
+        prev[str & wmask] = head[h];
+        head[h] = (Pos)str;
+        if (with3) s->head3[HASH3(s, str)] = (Pos)str;
+    }
+}
 
 /* ===========================================================================
  * Initialize the hash table (avoiding 64K overflow for 16 bit systems).
@@ -155,36 +207,76 @@ static const config configuration_table[10] = {
  */
 #define CLEAR_HASH(s) \
     s->head[s->hash_size-1] = 0;    \
-    memset((uint8_t *)s->head, 0, (unsigned)(s->hash_size)*sizeof(*s->head));
+    memset((uint8_t *)s->head, 0, (unsigned)(s->hash_size)*sizeof(*s->head)); \
+    memset((uint8_t *)s->head3, 0, HASH3_SIZE*sizeof(*s->head3));
 
 /* ===========================================================================
- * Slide the hash table when sliding the window down (could be avoided with 32
- * bit values at the expense of memory usage). We slide even when level == 0 to
- * keep the hash table consistent if we switch back to level > 0 later.
+ * Subtract wsize from every position in table. Positions that drop out of
+ * the window become 0, which marks the end of a hash chain.
  */
-static void slide_hash(deflate_state* s)
+static void slide_table_c(Pos* table, uint32_t n, uint32_t wsize)
 {
-    uint64_t n, m;
-    Pos *p;
-    uint64_t wsize = s->w_size;
+    uint32_t m;
+    Pos *p = &table[n];
 
-    n = s->hash_size;
-    p = &s->head[n];
-    do {
-        m = *--p;
-        *p = (Pos)(m >= wsize ? m - wsize : 0);
-    } while (--n);
-    n = wsize;
-#ifndef FASTEST
-    p = &s->prev[n];
     do {
         m = *--p;
         *p = (Pos)(m >= wsize ? m - wsize : 0);
-        /* If n is not on any hash chain, prev[n] is garbage but
-         * its value will never be used.
-         */
     } while (--n);
+}
+
+#ifdef ZLIB_X86
+/* A saturating subtract does the subtract-and-clamp on 8 or 16 entries at
+ * once. All tables hold a multiple of 16 entries.
+ */
+__attribute__((target("sse2")))
+static void slide_table_sse2(Pos* table, uint32_t n, uint32_t wsize)
+{
+    const __m128i w = _mm_set1_epi16((short)wsize);
+
+    for (Pos *p = table, *end = table + n; p != end; p += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        _mm_storeu_si128((__m128i *)p, _mm_subs_epu16(v, w));
+    }
+}
+
+__attribute__((target("avx2")))
+static void slide_table_avx2(Pos* table, uint32_t n, uint32_t wsize)
+{
+    const __m256i w = _mm256_set1_epi16((short)wsize);
+
+    for (Pos *p = table, *end = table + n; p != end; p += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        _mm256_storeu_si256((__m256i *)p, _mm256_subs_epu16(v, w));
+    }
+}
 #endif
+
+static const kernel_variant slide_hash_variants[] = {
+#ifdef ZLIB_X86
+    { "avx2", CPU_AVX2, (kernel_fn)slide_table_avx2 },
+    { "sse2", CPU_SSE2, (kernel_fn)slide_table_sse2 },
+#endif
+    { "c",    0,        (kernel_fn)slide_table_c },
+};
+
+kernel slide_hash_kernel = { "slide_hash", slide_hash_variants, sizeof(slide_hash_variants) / sizeof(slide_hash_variants[0]), {} };
+
+/* ===========================================================================
+ * Slide the hash table when sliding the window down (could be avoided with 32
+ * bit values at the expense of memory usage). We slide even when level == 0 to
+ * keep the hash table consistent if we switch back to level > 0 later.
+ */
+static void slide_hash(deflate_state* s)
+{
+    slide_func slide_table = kernel_get<slide_func>(&slide_hash_kernel);
+
+    slide_table(s->head, s->hash_size, s->w_size);
+    slide_table(s->head3, HASH3_SIZE, s->w_size);
+    /* Entries of prev[] that are not on any hash chain are garbage, but
+     * their value will never be used.
+     */
+    slide_table(s->prev, s->w_size, s->w_size);
 }
 
 int deflateInit(z_stream* strm, int level, const char* version, int stream_size)
@@ -223,7 +315,7 @@ int deflateInit2(z_stream* strm, int level, int method, int windowBits, int memL
         windowBits -= 16;
     }
     if (memLevel < 1 || memLevel > MAX_MEM_LEVEL || method != Z_DEFLATED ||
-        windowBits < 8 || windowBits > 15 || level < 0 || level > 9 ||
+        windowBits < 8 || windowBits > 15 || level < 0 || level > Z_OPTIMAL_COMPRESSION ||
         strategy < 0 || strategy > Z_FIXED || (windowBits == 8 && wrap != 1)) {
         return Z_STREAM_ERROR;
     }
@@ -243,11 +335,12 @@ int deflateInit2(z_stream* strm, int level, int method, int windowBits, int memL
     s->hash_bits = (uint16_t)memLevel + 7;
     s->hash_size = 1 << s->hash_bits;
     s->hash_mask = s->hash_size - 1;
-    s->hash_shift =  ((s->hash_bits+MIN_MATCH-1)/MIN_MATCH);
+    s->hash_shift = 32 - s->hash_bits;
 
     s->window = (uint8_t *) calloc( s->w_size, 2*sizeof(uint8_t));
     s->prev   = (Pos *)  calloc( s->w_size, sizeof(Pos));
     s->head   = (Pos *)  calloc( s->hash_size, sizeof(Pos));
+    s->head3  = (Pos *)  calloc( HASH3_SIZE, sizeof(Pos));
 
     s->high_water = 0;      /* nothing written to s->window yet */
 
@@ -258,6 +351,7 @@ int deflateInit2(z_stream* strm, int level, int method, int windowBits, int memL
     s->pending_buf_size = (uint32_t)s->lit_bufsize * (sizeof(uint16_t)+2L);
 
     if (s->window == nullptr || s->prev == nullptr || s->head == nullptr ||
+        s->head3 == nullptr ||
         s->pending_buf == nullptr) {
         s->status = FINISH_STATE;
         strm->msg = ERR_MSG(Z_MEM_ERROR);
@@ -270,6 +364,14 @@ int deflateInit2(z_stream* strm, int level, int method, int windowBits, int memL
     s->level = level;
     s->strategy = strategy;
     s->method = (uint8_t)method;
+    s->longest_match = kernel_get<match_func>(&longest_match_kernel);
+
+    if (configuration_table[level].func == deflate_optimal && opt_alloc(s) != Z_OK) {
+        s->status = FINISH_STATE;
+        strm->msg = ERR_MSG(Z_MEM_ERROR);
+        deflateEnd (strm);
+        return Z_MEM_ERROR;
+    }
 
     return deflateReset(strm);
 }
@@ -295,6 +397,65 @@ static int deflateStateCheck (z_stream* strm)
     return 0;
 }
 
+/* ========================================================================= */
+int deflateSetDictionary (z_stream* strm, const uint8_t* dictionary, uint32_t dictLength)
+{
+    deflate_state *s;
+    uint32_t str, n;
+    int wrap;
+    uint64_t avail;
+    const uint8_t *next;
+
+    if (deflateStateCheck(strm) || dictionary == nullptr)
+        return Z_STREAM_ERROR;
+    s = strm->state;
+    wrap = s->wrap;
+    if (wrap == 2 || (wrap == 1 && s->status != INIT_STATE) || s->lookahead)
+        return Z_STREAM_ERROR;
+
+    /* when using zlib wrappers, compute Adler-32 for provided dictionary */
+    if (wrap == 1)
+        strm->adler = adler32(strm->adler, dictionary, dictLength);
+    s->wrap = 0;                    /* avoid computing Adler-32 in read_buf */
+
+    /* if dictionary would fill window, just replace the history */
+    if (dictLength >= s->w_size) {
+        if (wrap == 0) {            /* already empty otherwise */
+            CLEAR_HASH(s);
+            s->strstart = 0;
+            s->block_start = 0L;
+            s->insert = 0;
+        }
+        dictionary += dictLength - s->w_size;  /* use the tail */
+        dictLength = s->w_size;
+    }
+
+    /* insert dictionary into window and hash */
+    avail = strm->avail_in;
+    next = strm->next_in;
+    strm->avail_in = dictLength;
+    strm->next_in = dictionary;
+    fill_window(s);
+    while (s->lookahead >= HASH_BYTES) {
+        str = s->strstart;
+        n = s->lookahead - (HASH_BYTES-1);
+        insert_strings<true>(s, str, n);
+        s->strstart = str + n;
+        s->lookahead = HASH_BYTES-1;
+        fill_window(s);
+    }
+    s->strstart += s->lookahead;
+    s->block_start = (long)s->strstart;
+    s->insert = s->lookahead;
+    s->lookahead = 0;
+    s->match_length = s->prev_length = MIN_MATCH-1;
+    s->match_available = 0;
+    strm->next_in = next;
+    strm->avail_in = avail;
+    s->wrap = wrap;
+    return Z_OK;
+}
+
 static int deflateResetKeep (z_stream* strm)
 {
     deflate_state *s;
@@ -328,7 +489,7 @@ static int deflateResetKeep (z_stream* strm)
 }
 
 /* ========================================================================= */
-static int deflateReset (z_stream* strm)
+int deflateReset (z_stream* strm)
 {
     int ret;
 
@@ -338,6 +499,74 @@ static int deflateReset (z_stream* strm)
     return ret;
 }
 
+/* =========================================================================
+ * For the default windowBits of 15 and memLevel of 8, this function returns a
+ * close to exact, as well as small, upper bound on the compressed size. This
+ * is an expansion of ~0.03%, plus a small constant. For any other windowBits or
+ * memLevel, one of two worst case bounds is returned, an expansion of at most
+ * ~4% or ~13%, plus a small constant.
+ */
+uint64_t deflateBound (z_stream* strm, uint64_t sourceLen)
+{
+    deflate_state *s;
+    uint64_t fixedlen, storelen, wraplen;
+
+    /* upper bound for fixed blocks with 9-bit literals and length 255 --
+       ~13% overhead plus a small constant */
+    fixedlen = sourceLen + (sourceLen >> 3) + (sourceLen >> 8) +
+               (sourceLen >> 9) + 4;
+
+    /* upper bound for stored blocks with length 127 -- ~4% overhead plus a
+       small constant */
+    storelen = sourceLen + (sourceLen >> 5) + (sourceLen >> 7) +
+               (sourceLen >> 11) + 7;
+
+    /* if can't get parameters, return larger bound plus a zlib wrapper */
+    if (deflateStateCheck(strm))
+        return (fixedlen > storelen ? fixedlen : storelen) + 6;
+
+    /* compute wrapper length, which deflate(..., Z_FINISH) made negative */
+    s = strm->state;
+    switch (s->wrap < 0 ? -s->wrap : s->wrap) {
+    case 0:                                 /* raw deflate */
+        wraplen = 0;
+        break;
+    case 1:                                 /* zlib wrapper */
+        wraplen = 6 + (s->strstart ? 4 : 0);
+        break;
+    case 2:                                 /* gzip wrapper */
+        wraplen = 18;
+        if (s->gzhead != nullptr) {         /* user-supplied gzip header */
+            uint8_t *str;
+            if (s->gzhead->extra != nullptr)
+                wraplen += 2 + s->gzhead->extra_len;
+            str = s->gzhead->name;
+            if (str != nullptr)
+                do {
+                    wraplen++;
+                } while (*str++);
+            str = s->gzhead->comment;
+            if (str != nullptr)
+                do {
+                    wraplen++;
+                } while (*str++);
+            if (s->gzhead->hcrc)
+                wraplen += 2;
+        }
+        break;
+    default:                                /* for compiler happiness */
+        wraplen = 6;
+    }
+
+    /* if not default parameters, return one of the conservative bounds */
+    if (s->w_bits != 15 || s->hash_bits != 8 + 7)
+        return (s->w_bits <= s->hash_bits && s->level ? fixedlen : storelen) +
+               wraplen;
+
+    /* default settings: return tight bound for that case */
+    return deflateRawBound(sourceLen) + wraplen;
+}
+
 /* =========================================================================
  * Put a short in the pending buffer. The 16-bit value is put in MSB order.
  * IN assertion: the stream state is correct and there is enough room in
@@ -482,7 +711,7 @@ int deflate(z_stream* strm, int flush)
             put_byte(s, 0);
             put_byte(s, 0);
             put_byte(s, 0);
-            put_byte(s, s->level == 9 ? 2 :
+            put_byte(s, s->level >= 9 ? 2 :
                      (s->strategy >= Z_HUFFMAN_ONLY || s->level < 2 ?
                       4 : 0));
             put_byte(s, 3);
@@ -506,7 +735,7 @@ int deflate(z_stream* strm, int flush)
             put_byte(s, (uint8_t)((s->gzhead->time >> 8) & 0xff));
             put_byte(s, (uint8_t)((s->gzhead->time >> 16) & 0xff));
             put_byte(s, (uint8_t)((s->gzhead->time >> 24) & 0xff));
-            put_byte(s, s->level == 9 ? 2 :
+            put_byte(s, s->level >= 9 ? 2 :
                      (s->strategy >= Z_HUFFMAN_ONLY || s->level < 2 ?
                       4 : 0));
             put_byte(s, s->gzhead->os & 0xff);
@@ -703,8 +932,10 @@ int deflateEnd (z_stream* strm)
     /* Deallocate in reverse order of allocations: */
     if (strm->state->pending_buf) free(strm->state->pending_buf);
     if (strm->state->head) free(strm->state->head);
+    if (strm->state->head3) free(strm->state->head3);
     if (strm->state->prev) free(strm->state->prev);
     if (strm->state->window) free(strm->state->window);
+    opt_free(strm->state);
 
     free(strm->state);
     strm->state = nullptr;
@@ -728,12 +959,14 @@ static size_t read_buf(z_stream* strm, uint8_t* buf, size_t size)
 
     strm->avail_in  -= len;
 
-    memcpy(buf, strm->next_in, len);
     if (strm->state->wrap == 1) {
-        strm->adler = adler32(strm->adler, buf, len);
+        strm->adler = adler32_copy(strm->adler, buf, strm->next_in, len);
     }
     else if (strm->state->wrap == 2) {
-        strm->adler = crc32(strm->adler, buf, len);
+        strm->adler = crc32_copy(strm->adler, buf, strm->next_in, len);
+    }
+    else {
+        memcpy(buf, strm->next_in, len);
     }
     strm->next_in  += len;
     strm->total_in += len;
@@ -763,7 +996,75 @@ static void lm_init (deflate_state* s)
     s->insert = 0;
     s->match_length = s->prev_length = MIN_MATCH-1;
     s->match_available = 0;
-    s->ins_h = 0;
+    if (s->opt) opt_reset(s);
+}
+
+/* ===========================================================================
+ * Return the length of the common prefix of scan and match, capped at
+ * MAX_MATCH. The first two bytes are known to be equal and are not
+ * compared. Both strings must have MAX_MATCH readable bytes.
+ */
+static inline uint64_t compare258_c(const uint8_t* scan, const uint8_t* match)
+{
+    const uint8_t *strend = scan + MAX_MATCH;
+
+    if (scan[2] != match[2]) return 2;
+    scan += 2, match += 2;
+
+    /* We check for insufficient lookahead only every 8th comparison;
+     * the 256th check will be made at strstart+258.
+     */
+    do {
+    } while (*++scan == *++match && *++scan == *++match &&
+             *++scan == *++match && *++scan == *++match &&
+             *++scan == *++match && *++scan == *++match &&
+             *++scan == *++match && *++scan == *++match &&
+             scan < strend);
+
+    return MAX_MATCH - (uint64_t)(strend - scan);
+}
+
+#ifdef ZLIB_X86
+/* Same as above, comparing 16 bytes per step. SSE2 is part of x86-64. */
+__attribute__((target("sse2")))
+static inline uint64_t compare258_sse2(const uint8_t* scan, const uint8_t* match)
+{
+    for (uint64_t len = 2; len < MAX_MATCH; len += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(scan + len));
+        __m128i b = _mm_loadu_si128((const __m128i *)(match + len));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xFFFF;
+        if (mask) return len + (uint64_t)__builtin_ctz(mask);
+    }
+    return MAX_MATCH;
+}
+
+/* Same as above, comparing 32 bytes per step. */
+__attribute__((target("avx2")))
+static inline uint64_t compare258_avx2(const uint8_t* scan, const uint8_t* match)
+{
+    for (uint64_t len = 2; len < MAX_MATCH; len += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(scan + len));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(match + len));
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+        if (mask) return len + (uint64_t)__builtin_ctz(mask);
+    }
+    return MAX_MATCH;
+}
+#endif
+
+/* Unaligned loads for the early-reject checks in longest_match. */
+static inline uint16_t load16(const uint8_t* p)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t load64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
 }
 
 /* ===========================================================================
@@ -774,8 +1075,13 @@ static void lm_init (deflate_state* s)
  * IN assertions: cur_match is the head of the hash chain for the current
  *   string (strstart) and its distance is <= MAX_DIST, and prev_length >= 1
  * OUT assertion: the match length is not greater than s->lookahead.
+ *
+ * The body is instantiated once per compare258 variant so that the variant
+ * is inlined into a function compiled for the matching instruction set.
  */
-static uint64_t longest_match(deflate_state* s, IPos cur_match)
+template <uint64_t (*compare258)(const uint8_t*, const uint8_t*)>
+__attribute__((always_inline))
+static inline uint64_t longest_match_tpl(deflate_state* s, IPos cur_match)
 {
     uint64_t chain_length = s->max_chain_length;/* max hash chain length */
     uint8_t *scan = s->window + s->strstart; /* current string */
@@ -791,9 +1097,14 @@ static uint64_t longest_match(deflate_state* s, IPos cur_match)
     Pos *prev = s->prev;
     uint32_t wmask = s->w_mask;
 
-    uint8_t *strend = s->window + s->strstart + MAX_MATCH;
-    uint8_t scan_end1  = scan[best_len-1];
-    uint8_t scan_end   = scan[best_len];
+    /* A candidate can only beat best_len if it agrees with scan on the
+     * first two bytes and on the bytes up to and including best_len.
+     * Once best_len >= 7 the 8 bytes ending at best_len are checked in
+     * one load; before that only the two bytes ending there are.
+     */
+    uint16_t scan_start = load16(scan);
+    uint64_t end_off    = best_len >= 7 ? best_len - 7 : best_len - 1;
+    uint64_t scan_end   = best_len >= 7 ? load64(scan + end_off) : load16(scan + end_off);
 
     /* Do not waste too much time if we already have a good match: */
     if (s->prev_length >= s->good_match) {
@@ -815,38 +1126,25 @@ static uint64_t longest_match(deflate_state* s, IPos cur_match)
          * However the length of the match is limited to the lookahead, so
          * the output of deflate is not affected by the uninitialized values.
          */
-        if (match[best_len]   != scan_end  ||
-            match[best_len-1] != scan_end1 ||
-            *match            != *scan     ||
-            *++match          != scan[1])      continue;
-
-        /* The check at best_len-1 can be removed because it will be made
-         * again later. (This heuristic is not always a win.)
-         * It is not necessary to compare scan[2] and match[2] since they
-         * are always equal when the other bytes match, given that
-         * the hash keys are equal and that HASH_BITS >= 8.
-         */
-        scan += 2, match++;
-
-        /* We check for insufficient lookahead only every 8th comparison;
-         * the 256th check will be made at strstart+258.
-         */
-        do {
-        } while (*++scan == *++match && *++scan == *++match &&
-                 *++scan == *++match && *++scan == *++match &&
-                 *++scan == *++match && *++scan == *++match &&
-                 *++scan == *++match && *++scan == *++match &&
-                 scan < strend);
+        if (best_len >= 7) {
+            if (load64(match + end_off) != scan_end) continue;
+        } else {
+            if (load16(match + end_off) != scan_end) continue;
+        }
+        if (load16(match) != scan_start) continue;
 
-        len = MAX_MATCH - (int)(strend - scan);
-        scan = strend - MAX_MATCH;
+        len = compare258(scan, match);
 
         if (len > best_len) {
             s->match_start = cur_match;
             best_len = len;
+            if (s->match_sink) {
+                s->match_sink[s->match_sink_len].len = (uint16_t)len;
+                s->match_sink[s->match_sink_len++].dist = (uint16_t)(s->strstart - cur_match);
+            }
             if (len >= nice_match) break;
-            scan_end1  = scan[best_len-1];
-            scan_end   = scan[best_len];
+            end_off  = best_len >= 7 ? best_len - 7 : best_len - 1;
+            scan_end = best_len >= 7 ? load64(scan + end_off) : load16(scan + end_off);
         }
     } while ((cur_match = prev[cur_match & wmask]) > limit
              && --chain_length != 0);
@@ -855,6 +1153,35 @@ static uint64_t longest_match(deflate_state* s, IPos cur_match)
     return s->lookahead;
 }
 
+static uint64_t longest_match_c(deflate_state* s, IPos cur_match)
+{
+    return longest_match_tpl<compare258_c>(s, cur_match);
+}
+
+#ifdef ZLIB_X86
+__attribute__((target("sse2")))
+static uint64_t longest_match_sse2(deflate_state* s, IPos cur_match)
+{
+    return longest_match_tpl<compare258_sse2>(s, cur_match);
+}
+
+__attribute__((target("avx2")))
+static uint64_t longest_match_avx2(deflate_state* s, IPos cur_match)
+{
+    return longest_match_tpl<compare258_avx2>(s, cur_match);
+}
+#endif
+
+static const kernel_variant longest_match_variants[] = {
+#ifdef ZLIB_X86
+    { "avx2", CPU_AVX2, (kernel_fn)longest_match_avx2 },
+    { "sse2", CPU_SSE2, (kernel_fn)longest_match_sse2 },
+#endif
+    { "c",    0,        (kernel_fn)longest_match_c },
+};
+
+kernel longest_match_kernel = { "longest_match", longest_match_variants, sizeof(longest_match_variants) / sizeof(longest_match_variants[0]), {} };
+
 /* ===========================================================================
  * Fill the window when the lookahead becomes insufficient.
  * Updates strstart and lookahead.
@@ -902,24 +1229,15 @@ static void fill_window(deflate_state* s)
         n = read_buf(s->strm, s->window + s->strstart + s->lookahead, more);
         s->lookahead += n;
 
-        /* Initialize the hash value now that we have some input: */
-        if (s->lookahead + s->insert >= MIN_MATCH) {
-            uint64_t str = s->strstart - s->insert;
-            s->ins_h = s->window[str];
-            UPDATE_HASH(s, s->ins_h, s->window[str + 1]);
-            while (s->insert) {
-                UPDATE_HASH(s, s->ins_h, s->window[str + MIN_MATCH-1]);
-                s->prev[str & s->w_mask] = s->head[s->ins_h];
-                s->head[s->ins_h] = (Pos)str;
-                str++;
-                s->insert--;
-                if (s->lookahead + s->insert < MIN_MATCH)
-                    break;
-            }
-        }
-        /* If the whole input has less than MIN_MATCH bytes, ins_h is garbage,
-         * but this is not important since only literal bytes will be emitted.
+        /* Insert the strings left over at the end of the previous input
+         * now that they have HASH_BYTES bytes of data:
          */
+        if (s->lookahead + s->insert >= HASH_BYTES) {
+            uint32_t n_insert = s->lookahead + s->insert - (HASH_BYTES-1);
+            if (n_insert > s->insert) n_insert = (uint32_t)s->insert;
+            insert_strings<true>(s, s->strstart - (uint32_t)s->insert, n_insert);
+            s->insert -= n_insert;
+        }
 
     } while (s->lookahead < MIN_LOOKAHEAD && s->strm->avail_in != 0);
 
@@ -984,6 +1302,87 @@ static void fill_window(deflate_state* s)
 /* Minimum of a and b. */
 #define MIN(a, b) ((a) > (b) ? (b) : (a))
 
+/* ===========================================================================
+ * Compress as much as possible from the input stream, return the current
+ * block state.
+ * This function does not perform lazy evaluation of matches and inserts
+ * new strings in the dictionary only for unmatched strings or for short
+ * matches. It is used only for the fast compression options.
+ */
+static block_state deflate_fast(deflate_state* s, int flush)
+{
+    IPos hash_head;          /* head of the hash chain */
+    int bflush;              /* set if current block must be flushed */
+
+    for (;;) {
+        /* Make sure that we always have enough lookahead, except
+         * at the end of the input file. We need MAX_MATCH bytes
+         * for the next match, plus MIN_MATCH bytes to insert the
+         * string following the next match.
+         */
+        if (s->lookahead < MIN_LOOKAHEAD) {
+            fill_window(s);
+            if (s->lookahead < MIN_LOOKAHEAD && flush == Z_NO_FLUSH) {
+                return need_more;
+            }
+            if (s->lookahead == 0) break; /* flush the current block */
+        }
+
+        /* Insert the string window[strstart .. strstart+3] in the
+         * dictionary, and set hash_head to the head of the hash chain:
+         */
+        hash_head = 0;
+        if (s->lookahead >= HASH_BYTES) {
+            INSERT_STRING(s, s->strstart, hash_head);
+        }
+
+        /* Find the longest match, discarding those <= prev_length.
+         * At this point we have always match_length < MIN_MATCH
+         */
+        if (hash_head != 0 && s->strstart - hash_head <= MAX_DIST(s)) {
+            /* To simplify the code, we prevent matches with the string
+             * of window index 0 (in particular we have to avoid a match
+             * of the string with itself at the start of the input file).
+             */
+            s->match_length = s->longest_match (s, hash_head);
+            /* longest_match() sets match_start */
+        }
+        if (s->match_length >= MIN_MATCH) {
+            _tr_tally_dist(s, s->strstart - s->match_start,
+                           s->match_length - MIN_MATCH, bflush);
+
+            s->lookahead -= s->match_length;
+
+            /* Insert new strings in the hash table only if the match length
+             * is not too large. This saves time but degrades compression.
+             * The string at strstart is already in the table; the last one
+             * inserted has lookahead+1 bytes ahead of it.
+             */
+            if (s->match_length <= s->max_insert_length &&
+                s->lookahead >= HASH_BYTES-1) {
+                insert_strings<false>(s, s->strstart + 1,
+                                      (uint32_t)s->match_length - 1);
+            }
+            s->strstart += s->match_length;
+            s->match_length = 0;
+        } else {
+            /* No match, output a literal byte */
+            _tr_tally_lit (s, s->window[s->strstart], bflush);
+            s->lookahead--;
+            s->strstart++;
+        }
+        if (bflush) FLUSH_BLOCK(s, 0);
+    }
+    s->insert = s->strstart < HASH_BYTES-1 ? s->strstart : HASH_BYTES-1;
+    if (flush == Z_FINISH) {
+        FLUSH_BLOCK(s, 1);
+        return finish_done;
+    }
+    if (s->last_lit)
+        FLUSH_BLOCK(s, 0);
+    return block_done;
+}
+
 /* ===========================================================================
  * Same as above, but achieves better compression. We use a lazy
  * evaluation for matches: a match is finally adopted only if there is
@@ -992,6 +1391,7 @@ static void fill_window(deflate_state* s)
 static block_state deflate_slow(deflate_state* s, int flush)
 {
     IPos hash_head;          /* head of hash chain */
+    IPos hash3_head;         /* most recent string with the same 3 bytes */
     int bflush;              /* set if current block must be flushed */
 
     /* Process the input block. */
@@ -1009,12 +1409,13 @@ static block_state deflate_slow(deflate_state* s, int flush)
             if (s->lookahead == 0) break; /* flush the current block */
         }
 
-        /* Insert the string window[strstart .. strstart+2] in the
+        /* Insert the string window[strstart .. strstart+3] in the
          * dictionary, and set hash_head to the head of the hash chain:
          */
-        hash_head = 0;
-        if (s->lookahead >= MIN_MATCH) {
+        hash_head = hash3_head = 0;
+        if (s->lookahead >= HASH_BYTES) {
             INSERT_STRING(s, s->strstart, hash_head);
+            INSERT_STRING3(s, s->strstart, hash3_head);
         }
 
         /* Find the longest match, discarding those <= prev_length.
@@ -1028,7 +1429,7 @@ static block_state deflate_slow(deflate_state* s, int flush)
              * of window index 0 (in particular we have to avoid a match
              * of the string with itself at the start of the input file).
              */
-            s->match_length = longest_match (s, hash_head);
+            s->match_length = s->longest_match (s, hash_head);
             /* longest_match() sets match_start */
 
             if (s->match_length <= 5 && (s->strategy == Z_FILTERED
@@ -1042,11 +1443,24 @@ static block_state deflate_slow(deflate_state* s, int flush)
                 s->match_length = MIN_MATCH-1;
             }
         }
+        /* The hash chains only hold strings that share 4 bytes, so fall
+         * back to the most recent 3-byte match when they found nothing.
+         * Like above, 3-byte matches further than 4096 bytes away are not
+         * worth their distance code.
+         */
+        if (s->match_length < MIN_MATCH && s->prev_length < MIN_MATCH &&
+            hash3_head != 0 && s->strstart - hash3_head <= 4096 &&
+            s->strstart - hash3_head <= MAX_DIST(s) &&
+            s->strategy != Z_FILTERED &&
+            memcmp(s->window + hash3_head, s->window + s->strstart, MIN_MATCH) == 0) {
+            s->match_length = MIN_MATCH;
+            s->match_start = hash3_head;
+        }
         /* If there was a match at the previous step and the current
          * match is not better, output the previous match:
          */
         if (s->prev_length >= MIN_MATCH && s->match_length <= s->prev_length) {
-            uint64_t max_insert = s->strstart + s->lookahead - MIN_MATCH;
+            uint64_t max_insert = s->strstart + s->lookahead - HASH_BYTES;
             /* Do not insert strings in hash table beyond this. */
 
             _tr_tally_dist(s, s->strstart -1 - s->prev_match,
@@ -1054,19 +1468,19 @@ static block_state deflate_slow(deflate_state* s, int flush)
 
             /* Insert in hash table all strings up to the end of the match.
              * strstart-1 and strstart are already inserted. If there is not
-             * enough lookahead, the last two strings are not inserted in
+             * enough lookahead, the last strings are not inserted in
              * the hash table.
              */
+            uint64_t last = s->strstart + s->prev_length - 2;
+            if (last > max_insert) last = max_insert;
+            if (last > s->strstart) {
+                insert_strings<true>(s, s->strstart + 1,
+                                     (uint32_t)(last - s->strstart));
+            }
             s->lookahead -= s->prev_length-1;
-            s->prev_length -= 2;
-            do {
-                if (++s->strstart <= max_insert) {
-                    INSERT_STRING(s, s->strstart, hash_head);
-                }
-            } while (--s->prev_length != 0);
+            s->strstart += s->prev_length-1;
             s->match_available = 0;
             s->match_length = MIN_MATCH-1;
-            s->strstart++;
 
             if (bflush) FLUSH_BLOCK(s, 0);
 
@@ -1095,7 +1509,327 @@ static block_state deflate_slow(deflate_state* s, int flush)
         _tr_tally_lit(s, s->window[s->strstart-1], bflush);
         s->match_available = 0;
     }
-    s->insert = s->strstart < MIN_MATCH-1 ? s->strstart : MIN_MATCH-1;
+    s->insert = s->strstart < HASH_BYTES-1 ? s->strstart : HASH_BYTES-1;
+    if (flush == Z_FINISH) {
+        FLUSH_BLOCK(s, 1);
+        return finish_done;
+    }
+    if (s->last_lit)
+        FLUSH_BLOCK(s, 0);
+    return block_done;
+}
+
+/* ===========================================================================
+ * Optimal parsing, used for level 10.
+ *
+ * Instead of deciding match by match, deflate_optimal() collects the
+ * matches at every position of a segment of up to w_size bytes and picks
+ * the cheapest way to cover the whole segment: a shortest path over the
+ * graph whose edges are literals and (length, distance) pairs, weighted by
+ * their cost in bits. The costs come from the Huffman trees that the
+ * previous parse of the same segment would get (_tr_costs() in trees.c),
+ * starting from the static trees, and the parse is redone until it stops
+ * getting cheaper. The chosen literals and matches are then tallied as
+ * usual, so blocks and trees are built exactly as for the other levels.
+ */
+#define OPT_ITERATIONS 8
+/* Maximum number of times a segment is parsed */
+
+#define OPT_MATCHES_PER_POS 8
+/* Average number of matches per position the match buffer is sized for */
+
+typedef struct opt_state_s {
+    uint32_t  *cost;    /* cost of the cheapest path to each position */
+    opt_match *from;    /* last step of that path */
+    uint32_t  *first;   /* index in matches of the first match at each position */
+    opt_match *matches; /* matches found at all positions of the segment */
+    uint32_t  matches_size;
+    opt_match *parse;   /* steps of the current parse, in order */
+    opt_match *best;    /* steps of the cheapest parse so far */
+    uint32_t  count;    /* number of steps in parse */
+    uint32_t  next;     /* next step of parse to tally */
+} opt_state;
+
+static int opt_alloc(deflate_state* s)
+{
+    uint32_t n = s->w_size + 1;
+    opt_state *opt = (opt_state *) calloc(1, sizeof(opt_state));
+
+    s->opt = opt;
+    if (opt == nullptr) return Z_MEM_ERROR;
+    opt->matches_size = s->w_size * OPT_MATCHES_PER_POS;
+    opt->cost    = (uint32_t *)  calloc(n, sizeof(uint32_t));
+    opt->from    = (opt_match *) calloc(n, sizeof(opt_match));
+    opt->first   = (uint32_t *)  calloc(n, sizeof(uint32_t));
+    opt->matches = (opt_match *) calloc(opt->matches_size, sizeof(opt_match));
+    opt->parse   = (opt_match *) calloc(n, sizeof(opt_match));
+    opt->best    = (opt_match *) calloc(n, sizeof(opt_match));
+    if (opt->cost == nullptr || opt->from == nullptr || opt->first == nullptr ||
+        opt->matches == nullptr || opt->parse == nullptr || opt->best == nullptr)
+        return Z_MEM_ERROR;
+    return Z_OK;
+}
+
+static void opt_reset(deflate_state* s)
+{
+    s->opt->count = s->opt->next = 0;
+}
+
+static void opt_free(deflate_state* s)
+{
+    opt_state *opt = s->opt;
+
+    if (opt == nullptr) return;
+    free(opt->best);
+    free(opt->parse);
+    free(opt->matches);
+    free(opt->first);
+    free(opt->from);
+    free(opt->cost);
+    free(opt);
+    s->opt = nullptr;
+}
+
+/* ===========================================================================
+ * Insert the strings of the next n positions in the hash tables and record
+ * all useful matches at each of them: for every length, the closest match
+ * of at least that length, as a list of increasing lengths and distances.
+ * Returns the number of positions done, which is less than n if the match
+ * buffer filled up.
+ */
+static uint32_t opt_find_matches(deflate_state* s, uint32_t n)
+{
+    opt_state *opt = s->opt;
+    uint32_t base = s->strstart;
+    uint32_t lookahead = s->lookahead;
+    uint32_t k = 0;              /* matches recorded so far */
+    uint32_t skip = 0;           /* positions left inside a maximal match */
+    uint32_t i;
+    IPos hash_head, hash3_head;
+
+    for (i = 0; i < n; i++) {
+        uint32_t avail = lookahead - i;
+        uint32_t str = base + i;
+
+        if (opt->matches_size - k < MAX_MATCH) break;
+        opt->first[i] = k;
+        if (avail < HASH_BYTES) continue;
+
+        INSERT_STRING(s, str, hash_head);
+        INSERT_STRING3(s, str, hash3_head);
+
+        /* Inside a match of maximal length every position has one as well;
+         * searching them costs much and gains next to nothing.
+         */
+        if (skip) {
+            skip--;
+            continue;
+        }
+
+        uint32_t found = 0;
+        if (hash_head != 0 && str - hash_head <= MAX_DIST(s)) {
+            s->strstart = str;
+            s->lookahead = avail;
+            s->prev_length = MIN_MATCH-1;
+            s->match_sink = opt->matches + k;
+            s->match_sink_len = 0;
+            s->longest_match(s, hash_head);
+            found = s->match_sink_len;
+            s->match_sink = nullptr;
+
+            /* Matches may run past the end of the input. */
+            for (uint32_t j = 0; j < found; j++) {
+                if (opt->matches[k+j].len >= avail) {
+                    opt->matches[k+j].len = (uint16_t)avail;
+                    found = j + 1;
+                }
+            }
+        }
+
+        /* The hash chains only hold strings sharing 4 bytes. Add the most
+         * recent 3-byte match if it is closer than what they found.
+         */
+        if (hash3_head != 0 && str - hash3_head <= MAX_DIST(s) &&
+            (found == 0 || opt->matches[k].dist > str - hash3_head) &&
+            memcmp(s->window + hash3_head, s->window + str, MIN_MATCH) == 0) {
+            if (found == 0 || opt->matches[k].len > MIN_MATCH) {
+                memmove(opt->matches + k + 1, opt->matches + k, found * sizeof(opt_match));
+                found++;
+            }
+            opt->matches[k].len = MIN_MATCH;
+            opt->matches[k].dist = (uint16_t)(str - hash3_head);
+        }
+
+        if (found && opt->matches[k+found-1].len >= s->nice_match) {
+            skip = opt->matches[k+found-1].len - 1;
+        }
+        k += found;
+    }
+    opt->first[i] = k;
+
+    s->strstart = base;
+    s->lookahead = lookahead;
+    return i;
+}
+
+/* ===========================================================================
+ * Find the cheapest parse of the next n positions under the given costs,
+ * store it in opt->parse and return its cost.
+ */
+static uint32_t opt_shortest_path(deflate_state* s, uint32_t n,
+                                  const uint32_t* lit_cost, const uint32_t* len_cost,
+                                  const uint32_t* dist_cost)
+{
+    opt_state *opt = s->opt;
+    const uint8_t *in = s->window + s->strstart;
+    uint32_t *cost = opt->cost;
+    opt_match *from = opt->from;
+    uint32_t i, count;
+
+    cost[0] = 0;
+    for (i = 1; i <= n; i++) cost[i] = UINT32_MAX;
+
+    for (i = 0; i < n; i++) {
+        uint32_t c = cost[i];
+        uint32_t len = MIN_MATCH;
+
+        if (c + lit_cost[in[i]] < cost[i+1]) {
+            cost[i+1] = c + lit_cost[in[i]];
+            from[i+1].len = 1;
+            from[i+1].dist = 0;
+        }
+        for (uint32_t k = opt->first[i]; k < opt->first[i+1]; k++) {
+            opt_match m = opt->matches[k];
+            uint32_t dc = c + dist_cost[d_code(m.dist - 1)];
+            uint32_t end = MIN((uint32_t)m.len, n - i);
+
+            for (; len <= end; len++) {
+                uint32_t t = dc + len_cost[len];
+                if (t < cost[i+len]) {
+                    cost[i+len] = t;
+                    from[i+len].len = (uint16_t)len;
+                    from[i+len].dist = m.dist;
+                }
+            }
+        }
+    }
+
+    /* Walk back from the end to collect the steps, then store them in order. */
+    count = 0;
+    for (i = n; i > 0; i -= from[i].len) count++;
+    opt->count = count;
+    for (i = n; i > 0; i -= from[i].len) opt->parse[--count] = from[i];
+    return cost[n];
+}
+
+/* ===========================================================================
+ * Parse the next n positions: find the matches, then iterate the shortest
+ * path search with costs taken from the trees of the previous parse. Leaves
+ * the cheapest parse found in opt->parse and returns the number of positions
+ * it covers.
+ */
+static uint32_t opt_parse_segment(deflate_state* s, uint32_t n)
+{
+    opt_state *opt = s->opt;
+    const uint8_t *in = s->window + s->strstart;
+    uint32_t lit_cost[LITERALS], len_cost[MAX_MATCH+1], dist_cost[D_CODES];
+    uint32_t lfreq[L_CODES], dfreq[D_CODES];
+    uint64_t best_bits = UINT64_MAX;
+    uint32_t best_count = 0;
+
+    n = opt_find_matches(s, n);
+
+    _tr_costs(s, nullptr, nullptr, lit_cost, len_cost, dist_cost);
+    for (int iter = 0; iter < OPT_ITERATIONS; iter++) {
+        uint64_t bits = 0;
+        uint32_t j, pos;
+
+        opt_shortest_path(s, n, lit_cost, len_cost, dist_cost);
+
+        /* Build the costs of the trees this parse would get, and see what
+         * the parse costs under them.
+         */
+        memset(lfreq, 0, sizeof(lfreq));
+        memset(dfreq, 0, sizeof(dfreq));
+        for (j = 0, pos = 0; j < opt->count; pos += opt->parse[j++].len) {
+            opt_match m = opt->parse[j];
+            if (m.len == 1) {
+                lfreq[in[pos]]++;
+            } else {
+                lfreq[_length_code[m.len-MIN_MATCH]+LITERALS+1]++;
+                dfreq[d_code(m.dist-1)]++;
+            }
+        }
+        _tr_costs(s, lfreq, dfreq, lit_cost, len_cost, dist_cost);
+        for (j = 0, pos = 0; j < opt->count; pos += opt->parse[j++].len) {
+            opt_match m = opt->parse[j];
+            bits += m.len == 1 ? lit_cost[in[pos]] :
+                    len_cost[m.len] + dist_cost[d_code(m.dist-1)];
+        }
+
+        if (bits >= best_bits) break;
+        best_bits = bits;
+        best_count = opt->count;
+        opt_match *tmp = opt->best;
+        opt->best = opt->parse;
+        opt->parse = tmp;
+    }
+
+    opt_match *tmp = opt->best;
+    opt->best = opt->parse;
+    opt->parse = tmp;
+    opt->count = best_count;
+    opt->next = 0;
+    return n;
+}
+
+/* ===========================================================================
+ * Same as deflate_slow(), but chooses literals and matches by optimal
+ * parsing of whole segments of the input (see above). Once a segment is
+ * parsed its steps are tallied; if the output buffer fills up while doing
+ * so, the remaining steps are picked up at the next call.
+ */
+static block_state deflate_optimal(deflate_state* s, int flush)
+{
+    opt_state *opt = s->opt;
+    int bflush;              /* set if current block must be flushed */
+
+    for (;;) {
+        /* Tally what is left of the current parse. */
+        while (opt->next < opt->count) {
+            opt_match m = opt->parse[opt->next++];
+            if (m.len == 1) {
+                _tr_tally_lit(s, s->window[s->strstart], bflush);
+            } else {
+                _tr_tally_dist(s, m.dist, m.len - MIN_MATCH, bflush);
+            }
+            s->strstart += m.len;
+            s->lookahead -= m.len;
+            if (bflush) FLUSH_BLOCK(s, 0);
+        }
+
+        /* Parse as much as possible at once: fill the window, and unless
+         * flushing, wait until it is full.
+         */
+        if (s->strstart + s->lookahead < s->window_size ||
+            s->strstart >= s->w_size + MAX_DIST(s)) {
+            fill_window(s);
+        }
+        if (flush == Z_NO_FLUSH && s->strstart + s->lookahead < s->window_size) {
+            return need_more;
+        }
+        if (s->lookahead == 0) break; /* flush the current block */
+
+        /* Keep MIN_LOOKAHEAD bytes for the next segment's matches, except
+         * at the end of the input. Matches are never searched for within
+         * MIN_LOOKAHEAD of the end of the window; fill_window() slides it
+         * before strstart gets there.
+         */
+        uint32_t n = flush == Z_NO_FLUSH ? s->lookahead - MIN_LOOKAHEAD : s->lookahead;
+        n = MIN(n, s->window_size - MIN_LOOKAHEAD - s->strstart);
+        opt_parse_segment(s, MIN(n, s->w_size));
+    }
+    s->insert = s->strstart < HASH_BYTES-1 ? s->strstart : HASH_BYTES-1;
     if (flush == Z_FINISH) {
         FLUSH_BLOCK(s, 1);
         return finish_done;
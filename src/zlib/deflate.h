@@ -17,7 +17,8 @@ namespace Zlib {
 #define BL_CODES  19
 #define HEAP_SIZE (2*L_CODES+1)
 #define MAX_BITS 15
-#define Buf_size 16
+#define Buf_size 64
+/* Number of bits in the bit buffer bi_buf. */
 
 enum State {
   INIT_STATE = 42,
@@ -58,6 +59,18 @@ typedef struct tree_desc_s {
 typedef uint16_t Pos;
 typedef uint32_t IPos;
 
+struct internal_state;
+typedef uint64_t (*match_func) (struct internal_state *s, IPos cur_match);
+/* Longest match search, selected at init time for the running CPU. */
+
+/* A match as recorded by the optimal parser: length 1 stands for a literal. */
+typedef struct opt_match_s {
+    uint16_t len;
+    uint16_t dist;
+} opt_match;
+
+struct opt_state_s;
+
 typedef struct internal_state {
     z_stream* strm;      /* pointer back to this zlib stream */
     int   status;        /* as the name implies */
@@ -81,12 +94,12 @@ typedef struct internal_state {
     uint32_t window_size;
     Pos *prev;
     Pos *head;
-    uint32_t  ins_h;          /* hash index of string to be inserted */
     uint32_t  hash_size;      /* number of elements in hash table */
     uint32_t  hash_bits;      /* log2(hash_size) */
     uint32_t  hash_mask;      /* hash_size-1 */
 
-    uint32_t  hash_shift;
+    uint32_t  hash_shift;     /* 32 - hash_bits */
+    Pos *head3;               /* most recent string per 3-byte hash */
     long block_start;
     uint64_t match_length;           /* length of best match */
     IPos prev_match;             /* previous match */
@@ -106,6 +119,15 @@ typedef struct internal_state {
     /* Use a faster search when the previous match is longer than this */
 
     int nice_match;
+    /* Stop searching when current match exceeds this */
+
+    match_func longest_match;  /* longest_match variant for this CPU */
+
+    opt_match *match_sink;
+    /* If set, longest_match appends every longer match it finds here */
+    uint32_t match_sink_len;
+
+    struct opt_state_s *opt;   /* buffers of deflate_optimal (level 10) */
 
     struct ct_data_s dyn_ltree[HEAP_SIZE];   /* literal and length tree */
     struct ct_data_s dyn_dtree[2*D_CODES+1]; /* distance tree */
@@ -134,8 +156,14 @@ typedef struct internal_state {
     uint64_t matches;       /* number of string matches in current block */
     uint64_t insert;        /* bytes at end of window left to insert */
 
-    uint16_t bi_buf;
+    uint64_t bi_buf;
+    /* Output buffer. bits are inserted starting at the bottom (least
+     * significant bits).
+     */
     int bi_valid;
+    /* Number of valid bits in bi_buf.  All bits above the last valid bit
+     * are always zero.
+     */
 
     uint64_t high_water;
 }  deflate_state;
@@ -151,6 +179,15 @@ typedef struct internal_state {
  * See deflate.c for comments about the MIN_MATCH+1.
  */
 
+#define HASH_BYTES 4
+/* Number of bytes hashed to find a string in the hash chains. Matches of
+ * MIN_MATCH bytes are found through the separate head3 table.
+ */
+
+#define HASH3_BITS 12
+#define HASH3_SIZE (1 << HASH3_BITS)
+/* Size of the head3 table used by the lazy matcher. */
+
 #define MAX_DIST(s)  ((s)->w_size-MIN_LOOKAHEAD)
 /* In order to simplify the code, particularly on 16 bit machines, match
  * distances are limited to MAX_DIST instead of WSIZE.
@@ -169,6 +206,8 @@ void _tr_flush_bits (deflate_state *s);
 void _tr_align (deflate_state *s);
 void _tr_stored_block (deflate_state *s, char *buf,
                         uint32_t stored_len, int last);
+void _tr_costs (deflate_state *s, const uint32_t *lfreq, const uint32_t *dfreq,
+                uint32_t *lit_cost, uint32_t *len_cost, uint32_t *dist_cost);
 
 #define d_code(dist) \
    ((dist) < 256 ? _dist_code[dist] : _dist_code[256+((dist)>>7)])
@@ -0,0 +1,122 @@
+/* infback.c -- inflate using a call-back interface
+ * Copyright (C) 1995-2016 Mark Adler
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+/*
+   Unlike the original, which duplicated the decoder of inflate.c, this
+   inflateBack() drives inflate() itself, with the caller's window as the
+   output buffer: matches copy straight from earlier output in the window,
+   and nothing is copied into it afterwards.
+ */
+
+#include "zutil.h"
+#include "inftrees.h"
+#include "inflate.h"
+#include "inffast.h"
+
+namespace Zlib {
+
+static_assert(inflateBackWindowSize(8) - (1 << 8) == INFLATE_FAST_OVERRUN,
+              "the window must leave room for inflate_fast() to overrun");
+
+/*
+   windowBits is in the range 8..15, and window is a user-supplied
+   window and output buffer of inflateBackWindowSize(windowBits) bytes.
+   That is 15 bytes more than the deflate window: inflate_fast() may write
+   that far past the end of a match, and with the larger ring it only ever
+   overwrites bytes that are too far back to be referred to.
+ */
+int inflateBackInit(z_stream* strm, int windowBits, uint8_t* window, const char* version, int stream_size)
+{
+    struct inflate_state  *state;
+    int ret;
+
+    if (windowBits < 8 || windowBits > 15 || window == nullptr)
+        return Z_STREAM_ERROR;
+    ret = inflateInit2(strm, -windowBits, version, stream_size);
+    if (ret != Z_OK) return ret;
+    state = (struct inflate_state  *)strm->state;
+    state->window = window;
+    state->ring = 1;
+    return Z_OK;
+}
+
+/*
+   inflateBack() decompresses a raw deflate stream, getting its input from
+   in() and passing the output to out() each time the window fills up and at
+   the end.  in() returns the number of bytes it made available at *buf, or
+   zero at the end of the input.  A non-zero return from out() stops
+   decompression.
+
+   Returns Z_STREAM_END on success, Z_BUF_ERROR if in() ran out of input or
+   out() returned non-zero, or Z_DATA_ERROR or Z_MEM_ERROR as inflate()
+   does.  On return, strm->next_in and strm->avail_in hold the input that was
+   not used, if any.
+ */
+int inflateBack(z_stream* strm, in_func in, void* in_desc, out_func out, void* out_desc)
+{
+    struct inflate_state  *state;
+    uint64_t room;              /* window space given to inflate() */
+    uint64_t made;              /* bytes inflate() wrote */
+    int eof;                    /* true once in() has no more input */
+    int ret;
+
+    if (strm == nullptr || strm->state == nullptr)
+        return Z_STREAM_ERROR;
+    state = (struct inflate_state  *)strm->state;
+    if (!state->ring)
+        return Z_STREAM_ERROR;
+
+    /* the window is the output buffer, from its start */
+    state->wsize = inflateBackWindowSize(state->wbits);
+    state->wnext = 0;
+    state->whave = 0;
+    strm->avail_in = 0;
+    eof = 0;
+
+    for (;;) {
+        if (strm->avail_in == 0 && !eof) {
+            strm->avail_in = in(in_desc, &strm->next_in);
+            if (strm->avail_in == 0) {
+                strm->next_in = nullptr;
+                eof = 1;
+            }
+        }
+        room = state->wsize - state->wnext;
+        strm->next_out = state->window + state->wnext;
+        strm->avail_out = room;
+        ret = inflate(strm, Z_NO_FLUSH);
+        made = room - strm->avail_out;
+        state->wnext += made;
+        state->whave += made;
+        if (state->whave > (1U << state->wbits))
+            state->whave = 1U << state->wbits;
+        if (ret != Z_OK && ret != Z_BUF_ERROR) break;
+
+        if (state->wnext == state->wsize) {
+            if (out(out_desc, state->window, state->wnext)) {
+                ret = Z_BUF_ERROR;
+                break;
+            }
+            state->wnext = 0;
+        }
+        else if (eof && made == 0) {    /* needs more input than there is */
+            ret = Z_BUF_ERROR;
+            break;
+        }
+    }
+
+    /* write whatever is left */
+    if (ret == Z_STREAM_END && state->wnext &&
+        out(out_desc, state->window, state->wnext))
+        ret = Z_BUF_ERROR;
+    return ret;
+}
+
+int inflateBackEnd(z_stream* strm)
+{
+    return inflateEnd(strm);
+}
+
+}
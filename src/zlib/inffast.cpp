@@ -7,6 +7,7 @@
 #include "inftrees.h"
 #include "inflate.h"
 #include "inffast.h"
+#include "cpu_features.h"
 
 namespace Zlib {
 /*
@@ -20,8 +21,8 @@ namespace Zlib {
    Entry assumptions:
 
         state->mode == LEN
-        strm->avail_in >= 6
-        strm->avail_out >= 258
+        strm->avail_in >= 8
+        strm->avail_out >= 273
         start >= strm->avail_out
         state->bits < 8
 
@@ -36,15 +37,97 @@ namespace Zlib {
     - The maximum input bits used by a length/distance pair is 15 bits for the
       length code, 5 bits for the length extra, 15 bits for the distance code,
       and 13 bits for the distance extra.  This totals 48 bits, or six bytes.
-      Therefore if strm->avail_in >= 6, then there is enough input to avoid
-      checking for available input while decoding.
+      The bit buffer is refilled once per code, eight bytes at a time and
+      without a branch, to hold at least 56 bits, so a whole length/distance
+      pair can be decoded from one refill.  That needs eight bytes of input,
+      hence strm->avail_in >= 8.
+
+    - The window may be the output buffer itself (see inflateBack()), so
+      copies from the window use memmove().
+
+    - Decoding starts with the pair table (see inflate_table_pairs()), whose
+      entries can hold two literals.  The next code after a table link is
+      always looked up in lcode.
+
+    - The table entries for lengths and distances count the extra bits in
+      here.bits (see inftrees.h), so the code and its extra bits are dropped
+      together with one shift, and the extra bits are taken from the bits
+      saved before it.
 
     - The maximum bytes that a single length/distance pair can output is 258
-      bytes, which is the maximum length that can be coded.  inflate_fast()
-      requires strm->avail_out >= 258 for each loop to avoid checking for
-      output space.
+      bytes, which is the maximum length that can be coded.  Matches are
+      copied 16 bytes at a time and may write up to 15 bytes past their end,
+      which is overwritten by what comes next.  inflate_fast() requires
+      strm->avail_out >= 273 for each loop to avoid checking for output
+      space.
  */
-void inflate_fast(z_stream* strm, uint64_t start)
+/* Load eight bytes as a little-endian number. */
+static inline uint64_t load64_le(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+/* Fill the bit buffer up to at least 56 bits. The whole eight bytes at in are
+   or'ed in, but in only advances past the bytes that fitted completely; the
+   bits of the next byte that are already there are simply or'ed in again
+   next time. */
+#define REFILL() \
+    do { \
+        hold |= load64_le(in) << bits; \
+        in += (63 - bits) >> 3; \
+        bits |= 56; \
+    } while (0)
+
+/* Copy 16 bytes from from to out, which may overlap. */
+static inline void copy16(unsigned char *out, const unsigned char *from)
+{
+    unsigned char chunk[16];
+    memcpy(chunk, from, 16);
+    memcpy(out, chunk, 16);
+}
+
+/* Copy a match of len bytes from dist bytes back in the output, 16 bytes at
+   a time, and return the new end of the output. Up to 15 bytes past the end
+   of the match are written as well. */
+static inline unsigned char *copy_match(unsigned char *out, unsigned dist,
+                                        uint64_t len)
+{
+    const unsigned char *from = out - dist;
+    unsigned char *stop = out + len;
+
+    if (dist == 1) {                    /* run of one byte */
+        memset(out, *from, len);
+        return stop;
+    }
+
+    /* A match closer than 16 bytes repeats a short pattern. Copy the pattern
+       after itself, doubling it each time, until it is at least 16 bytes
+       long; from then on each chunk can be copied whole from a multiple of
+       dist back. */
+    while (out - from < 16 && out < stop) {
+        copy16(out, from);
+        out += out - from;
+    }
+    while (out < stop) {
+        copy16(out, from);
+        out += 16;
+        from += 16;
+    }
+    return stop;
+}
+
+/* The extra bits of the length or distance in here, from the bit buffer as it
+   was before dropping here.bits. */
+#define EXTRA(saved, here, op) \
+    (unsigned)(((saved) & ((1ULL << (here).bits) - 1)) >> ((here).bits - (op)))
+
+__attribute__((always_inline))
+static inline void inflate_fast_tpl(z_stream* strm, uint64_t start)
 {
     struct inflate_state  *state;
     const unsigned char  *in;      /* static strm->next_in */
@@ -56,12 +139,14 @@ void inflate_fast(z_stream* strm, uint64_t start)
     uint64_t whave;             /* valid bytes in the window */
     uint64_t wnext;             /* window write index */
     unsigned char  *window;  /* allocated sliding window, if wsize != 0 */
-    unsigned long hold;         /* static strm->hold */
+    uint64_t hold;              /* static strm->hold */
+    uint64_t saved;             /* hold before dropping a code */
     uint64_t bits;              /* static strm->bits */
     code const  *lcode;      /* static strm->lencode */
     code const  *dcode;      /* static strm->distcode */
-    unsigned lmask;             /* mask for first level of length codes */
+    code const  *pcode;      /* static strm->paircode */
     unsigned dmask;             /* mask for first level of distance codes */
+    unsigned pmask;             /* mask for pcode */
     code here;                  /* retrieved table entry */
     uint64_t op;                /* code bits, operation, extra bits, or */
                                 /*  window position, window bytes to copy */
@@ -72,10 +157,10 @@ void inflate_fast(z_stream* strm, uint64_t start)
     /* copy state to static variables */
     state = (struct inflate_state  *)strm->state;
     in = strm->next_in;
-    last = in + (strm->avail_in - 5);
+    last = in + (strm->avail_in - 7);
     out = strm->next_out;
     beg = out - (start - strm->avail_out);
-    end = out + (strm->avail_out - 257);
+    end = out + (strm->avail_out - (INFLATE_FAST_MIN_LEFT - 1));
     wsize = state->wsize;
     whave = state->whave;
     wnext = state->wnext;
@@ -84,65 +169,39 @@ void inflate_fast(z_stream* strm, uint64_t start)
     bits = state->bits;
     lcode = state->lencode;
     dcode = state->distcode;
-    lmask = (1U << state->lenbits) - 1;
     dmask = (1U << state->distbits) - 1;
+    pcode = state->paircode;
+    pmask = (1U << state->pairbits) - 1;
 
     /* decode literals and length/distances until end-of-block or not enough
        input data or output space */
     do {
-        if (bits < 15) {
-            hold += (unsigned long)(*in++) << bits;
-            bits += 8;
-            hold += (unsigned long)(*in++) << bits;
-            bits += 8;
-        }
-        here = lcode[hold & lmask];
+        REFILL();
+        here = pcode[hold & pmask];
       dolen:
+        saved = hold;
         op = (unsigned)(here.bits);
         hold >>= op;
         bits -= op;
         op = (unsigned)(here.op);
-        if (op == 0) {                          /* literal */
-            *out++ = (unsigned char)(here.val);
+        if ((op & 127) == 0) {                  /* one or two literals */
+            out[0] = (unsigned char)(here.val);
+            out[1] = (unsigned char)(here.val >> 8);
+            out += 1 + (op >> 7);
         }
         else if (op & 16) {                     /* length base */
-            len = (unsigned)(here.val);
             op &= 15;                           /* number of extra bits */
-            if (op) {
-                if (bits < op) {
-                    hold += (unsigned long)(*in++) << bits;
-                    bits += 8;
-                }
-                len += (unsigned)hold & ((1U << op) - 1);
-                hold >>= op;
-                bits -= op;
-            }
-            if (bits < 15) {
-                hold += (unsigned long)(*in++) << bits;
-                bits += 8;
-                hold += (unsigned long)(*in++) << bits;
-                bits += 8;
-            }
+            len = (unsigned)(here.val) + EXTRA(saved, here, op);
             here = dcode[hold & dmask];
           dodist:
+            saved = hold;
             op = (unsigned)(here.bits);
             hold >>= op;
             bits -= op;
             op = (unsigned)(here.op);
             if (op & 16) {                      /* distance base */
-                dist = (unsigned)(here.val);
                 op &= 15;                       /* number of extra bits */
-                if (bits < op) {
-                    hold += (unsigned long)(*in++) << bits;
-                    bits += 8;
-                    if (bits < op) {
-                        hold += (unsigned long)(*in++) << bits;
-                        bits += 8;
-                    }
-                }
-                dist += (unsigned)hold & ((1U << op) - 1);
-                hold >>= op;
-                bits -= op;
+                dist = (unsigned)(here.val) + EXTRA(saved, here, op);
                 op = (unsigned)(out - beg);     /* max distance in output */
                 if (dist > op) {                /* see if copy from window */
                     op = dist - op;             /* distance back in window */
@@ -157,68 +216,34 @@ void inflate_fast(z_stream* strm, uint64_t start)
                     from = window;
                     if (wnext == 0) {           /* very common case */
                         from += wsize - op;
-                        if (op < len) {         /* some from window */
-                            len -= op;
-                            do {
-                                *out++ = *from++;
-                            } while (--op);
-                            from = out - dist;  /* rest from output */
-                        }
                     }
                     else if (wnext < op) {      /* wrap around window */
                         from += wsize + wnext - op;
                         op -= wnext;
                         if (op < len) {         /* some from end of window */
                             len -= op;
-                            do {
-                                *out++ = *from++;
-                            } while (--op);
-                            from = window;
-                            if (wnext < len) {  /* some from start of window */
-                                op = wnext;
-                                len -= op;
-                                do {
-                                    *out++ = *from++;
-                                } while (--op);
-                                from = out - dist;      /* rest from output */
-                            }
+                            memmove(out, from, op);
+                            out += op;
+                            from = window;      /* rest from start of window */
+                            op = wnext;
                         }
                     }
                     else {                      /* contiguous in window */
                         from += wnext - op;
-                        if (op < len) {         /* some from window */
-                            len -= op;
-                            do {
-                                *out++ = *from++;
-                            } while (--op);
-                            from = out - dist;  /* rest from output */
-                        }
                     }
-                    while (len > 2) {
-                        *out++ = *from++;
-                        *out++ = *from++;
-                        *out++ = *from++;
-                        len -= 3;
+                    if (op < len) {             /* some from window */
+                        len -= op;
+                        memmove(out, from, op);
+                        out += op;
+                        out = copy_match(out, dist, len);   /* rest from output */
                     }
-                    if (len) {
-                        *out++ = *from++;
-                        if (len > 1)
-                            *out++ = *from++;
+                    else {
+                        memmove(out, from, len);
+                        out += len;
                     }
                 }
                 else {
-                    from = out - dist;          /* copy direct from output */
-                    do {                        /* minimum length is three */
-                        *out++ = *from++;
-                        *out++ = *from++;
-                        *out++ = *from++;
-                        len -= 3;
-                    } while (len > 2);
-                    if (len) {
-                        *out++ = *from++;
-                        if (len > 1)
-                            *out++ = *from++;
-                    }
+                    out = copy_match(out, dist, len);   /* copy direct from output */
                 }
             }
             else if ((op & 64) == 0) {          /* 2nd level distance code */
@@ -250,19 +275,52 @@ void inflate_fast(z_stream* strm, uint64_t start)
     len = bits >> 3;
     in -= len;
     bits -= len << 3;
-    hold &= (1U << bits) - 1;
+    hold &= (1ULL << bits) - 1;
 
     /* update state and return */
     strm->next_in = in;
     strm->next_out = out;
-    strm->avail_in = (unsigned)(in < last ? 5 + (last - in) : 5 - (in - last));
+    strm->avail_in = (unsigned)(in < last ? 7 + (last - in) : 7 - (in - last));
     strm->avail_out = (unsigned)(out < end ?
-                                 257 + (end - out) : 257 - (out - end));
+                                 (INFLATE_FAST_MIN_LEFT - 1) + (end - out) :
+                                 (INFLATE_FAST_MIN_LEFT - 1) - (out - end));
     state->hold = hold;
     state->bits = bits;
     return;
 }
 
+/* The body is compiled once per instruction set, so that the bit buffer
+ * masks and shifts can use BMI2 where available.
+ */
+static void inflate_fast_c(z_stream* strm, uint64_t start)
+{
+    inflate_fast_tpl(strm, start);
+}
+
+#ifdef ZLIB_X86
+__attribute__((target("bmi2")))
+static void inflate_fast_bmi2(z_stream* strm, uint64_t start)
+{
+    inflate_fast_tpl(strm, start);
+}
+#endif
+
+typedef void (*inflate_fast_func) (z_stream* strm, uint64_t start);
+
+static const kernel_variant inflate_fast_variants[] = {
+#ifdef ZLIB_X86
+    { "bmi2", CPU_BMI2, (kernel_fn)inflate_fast_bmi2 },
+#endif
+    { "c",    0,        (kernel_fn)inflate_fast_c },
+};
+
+kernel inflate_fast_kernel = { "inflate_fast", inflate_fast_variants, sizeof(inflate_fast_variants) / sizeof(inflate_fast_variants[0]), {} };
+
+void inflate_fast(z_stream* strm, uint64_t start)
+{
+    kernel_get<inflate_fast_func>(&inflate_fast_kernel)(strm, start);
+}
+
 }
 
 /*
@@ -275,6 +333,7 @@ void inflate_fast(z_stream* strm, uint64_t start)
    - Deferring match copy and interspersed it with decoding subsequent codes
    - Swapping literal/length else
    - Swapping window/direct else
-   - Larger unrolled copy loops (three is about right)
+   - Larger unrolled copy loops (three is about right; since superseded by
+     16 byte chunk copies on machines with unaligned loads)
    - Moving len -= 3 statement into middle of loop
  */
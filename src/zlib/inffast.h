@@ -10,6 +10,12 @@
 
 namespace Zlib {
 
+/* inflate() only calls inflate_fast() with at least this much input and output
+   space available; see the entry assumptions in inffast.c. */
+#define INFLATE_FAST_MIN_HAVE 8
+#define INFLATE_FAST_OVERRUN 15     /* bytes written past the end of a match */
+#define INFLATE_FAST_MIN_LEFT (258 + INFLATE_FAST_OVERRUN)
+
 void inflate_fast (z_stream* strm, uint64_t start);
 
 }
@@ -91,9 +91,7 @@ namespace Zlib {
 static int inflateStateCheck (z_stream* strm);
 static void fixedtables (struct inflate_state  *state);
 static int updatewindow (z_stream* strm, const unsigned char  *end,
-                           uint64_t copy);
-
-static int inflateReset (z_stream* strm);
+                           uint64_t copy, int check);
 
 static int inflateReset2 (z_stream* strm,
                                       int windowBits);
@@ -131,12 +129,14 @@ static int inflateResetKeep(z_stream* strm)
     state->hold = 0;
     state->bits = 0;
     state->lencode = state->distcode = state->next = state->codes;
+    state->paircode = state->codes;
+    state->pairbits = 0;
     state->sane = 1;
     state->back = -1;
     return Z_OK;
 }
 
-static int inflateReset(z_stream* strm)
+int inflateReset(z_stream* strm)
 {
     struct inflate_state  *state;
 
@@ -217,11 +217,33 @@ static void fixedtables(inflate_state* state)
 #   include "inflate_fixed_tables.h"
     state->lencode = lenfix;
     state->lenbits = 9;
+    state->paircode = lenfix;   /* fixed literal codes are too long to pair */
+    state->pairbits = 9;
     state->distcode = distfix;
     state->distbits = 5;
 }
 
-static int updatewindow(z_stream* strm, const uint8_t* end, uint64_t copy)
+/* check function to use adler32() for zlib or crc32() for gzip */
+#  define UPDATE(check, buf, len) \
+    (state->flags ? crc32(check, buf, len) : adler32(check, buf, len))
+
+/* copy into the window for updatewindow(), updating the check if asked to */
+#  define WINDOW_COPY(dst, src, len) \
+    do { \
+        if (check) \
+            state->check = state->flags ? \
+                crc32_copy(state->check, dst, src, len) : \
+                adler32_copy(state->check, dst, src, len); \
+        else \
+            memcpy(dst, src, len); \
+    } while (0)
+
+/*
+   Update the window with the last copy bytes of output, which end at end.
+   If check is true, also update the check value with all of those bytes, on
+   the way for the ones that go into the window.
+ */
+static int updatewindow(z_stream* strm, const uint8_t* end, uint64_t copy, int check)
 {
     struct inflate_state  *state;
     uint64_t dist;
@@ -245,17 +267,20 @@ static int updatewindow(z_stream* strm, const uint8_t* end, uint64_t copy)
 
     /* copy state->wsize or less output bytes into the circular window */
     if (copy >= state->wsize) {
-        memcpy(state->window, end - state->wsize, state->wsize);
+        if (check)
+            state->check = UPDATE(state->check, end - copy,
+                                  copy - state->wsize);
+        WINDOW_COPY(state->window, end - state->wsize, state->wsize);
         state->wnext = 0;
         state->whave = state->wsize;
     }
     else {
         dist = state->wsize - state->wnext;
         if (dist > copy) dist = copy;
-        memcpy(state->window + state->wnext, end - copy, dist);
+        WINDOW_COPY(state->window + state->wnext, end - copy, dist);
         copy -= dist;
         if (copy) {
-            memcpy(state->window, end - copy, copy);
+            WINDOW_COPY(state->window, end - copy, copy);
             state->wnext = copy;
             state->whave = state->wsize;
         }
@@ -270,10 +295,6 @@ static int updatewindow(z_stream* strm, const uint8_t* end, uint64_t copy)
 
 /* Macros for inflate(): */
 
-/* check function to use adler32() for zlib or crc32() for gzip */
-#  define UPDATE(check, buf, len) \
-    (state->flags ? crc32(check, buf, len) : adler32(check, buf, len))
-
 /* check macros for header crc */
 #  define CRC2(check, word) \
     do { \
@@ -831,14 +852,17 @@ int inflate(z_stream* strm, int flush)
                 state->mode = BAD;
                 break;
             }
+            inflate_table_pairs(state->lencode, state->lenbits, state->pairs);
+            state->paircode = state->pairs;
+            state->pairbits = PAIRBITS;
             state->mode = LEN_;
             if (flush == Z_TREES) goto inf_leave;
         case LEN_:
             state->mode = LEN;
         case LEN:
-            if (have >= 6 && left >= 258) {
+            if (have >= INFLATE_FAST_MIN_HAVE && left >= INFLATE_FAST_MIN_LEFT) {
                 RESTORE();
-                inflate_fast(strm, out);
+                inflate_fast(strm, state->flat ? out + state->total : out);
                 LOAD();
                 if (state->mode == TYPE)
                     state->back = -1;
@@ -861,8 +885,8 @@ int inflate(z_stream* strm, int flush)
                 DROPBITS(last.bits);
                 state->back += last.bits;
             }
-            DROPBITS(here.bits);
-            state->back += here.bits;
+            DROPBITS(code_bits(here));
+            state->back += code_bits(here);
             state->length = (unsigned)here.val;
             if ((int)(here.op) == 0) {
                 state->mode = LIT;
@@ -906,8 +930,8 @@ int inflate(z_stream* strm, int flush)
                 DROPBITS(last.bits);
                 state->back += last.bits;
             }
-            DROPBITS(here.bits);
-            state->back += here.bits;
+            DROPBITS(code_bits(here));
+            state->back += code_bits(here);
             if (here.op & 64) {
                 strm->msg = "invalid distance code";
                 state->mode = BAD;
@@ -927,6 +951,7 @@ int inflate(z_stream* strm, int flush)
         case MATCH:
             if (left == 0) goto inf_leave;
             copy = out - left;
+            if (state->flat) copy += state->total;
             if (state->offset > copy) {         /* copy from window */
                 copy = state->offset - copy;
                 if (copy > state->whave) {
@@ -979,6 +1004,8 @@ int inflate(z_stream* strm, int flush)
                     state->mode = BAD;
                     break;
                 }
+                if (!(state->wrap & 4))
+                    strm->adler = state->flags ? hold : ZSWAP32(hold);
                 INITBITS();
             }
             state->mode = LENGTH;
@@ -1014,20 +1041,24 @@ int inflate(z_stream* strm, int flush)
      */
   inf_leave:
     RESTORE();
-    if (state->wsize || (out != strm->avail_out && state->mode < BAD &&
-            (state->mode < CHECK || flush != Z_FINISH)))
-        if (updatewindow(strm, strm->next_out, out - strm->avail_out)) {
+    in -= strm->avail_in;
+    out -= strm->avail_out;
+    if (!state->flat && !state->ring &&
+        (state->wsize || (out && state->mode < BAD &&
+            (state->mode < CHECK || flush != Z_FINISH)))) {
+        if (updatewindow(strm, strm->next_out, out,
+                         (state->wrap & 4) && out)) {
             state->mode = MEM;
             return Z_MEM_ERROR;
         }
-    in -= strm->avail_in;
-    out -= strm->avail_out;
+    }
+    else if ((state->wrap & 4) && out)
+        state->check = UPDATE(state->check, strm->next_out - out, out);
     strm->total_in += in;
     strm->total_out += out;
     state->total += out;
     if ((state->wrap & 4) && out)
-        strm->adler = state->check =
-            UPDATE(state->check, strm->next_out - out, out);
+        strm->adler = state->check;
     strm->data_type = (int)state->bits + (state->last ? 64 : 0) +
                       (state->mode == TYPE ? 128 : 0) +
                       (state->mode == LEN_ || state->mode == COPY_ ? 256 : 0);
@@ -1036,13 +1067,123 @@ int inflate(z_stream* strm, int flush)
     return ret;
 }
 
+/*
+   Promise that the output of the stream goes to one buffer: each call of
+   inflate() continues where the previous one left off, and the output is not
+   changed until the stream ends.  Matches then copy from the earlier output
+   directly, and no window is allocated or filled.
+ */
+int inflateNoWindow(z_stream* strm)
+{
+    if (inflateStateCheck(strm)) return Z_STREAM_ERROR;
+    ((struct inflate_state  *)strm->state)->flat = 1;
+    return Z_OK;
+}
+
+/*
+   Turn computing and checking the check value of the data off (check == 0) or
+   back on.  Without it, the check value stored after the data is left in
+   strm->adler when the stream ends, for the caller to compare against a check
+   value it computes itself.  The length in a gzip trailer is still checked.
+ */
+int inflateValidate(z_stream* strm, int check)
+{
+    struct inflate_state  *state;
+
+    if (inflateStateCheck(strm)) return Z_STREAM_ERROR;
+    state = (struct inflate_state  *)strm->state;
+    if (check && state->wrap)
+        state->wrap |= 4;
+    else
+        state->wrap &= ~4;
+    return Z_OK;
+}
+
+/*
+   Insert bits (up to 16 of them) into the bit buffer ahead of the input, to
+   start decoding at a position that is not on a byte boundary.  A negative
+   bits empties the bit buffer instead.
+ */
+int inflatePrime(z_stream* strm, int bits, int value)
+{
+    struct inflate_state  *state;
+
+    if (inflateStateCheck(strm)) return Z_STREAM_ERROR;
+    state = (struct inflate_state  *)strm->state;
+    if (bits < 0) {
+        state->hold = 0;
+        state->bits = 0;
+        return Z_OK;
+    }
+    if (bits > 16 || state->bits + (unsigned)bits > 32) return Z_STREAM_ERROR;
+    value &= (1L << bits) - 1;
+    state->hold += (unsigned long)value << state->bits;
+    state->bits += (unsigned)bits;
+    return Z_OK;
+}
+
+/*
+   Copy the window, the last up to 32K bytes of output, to dictionary, if it
+   is not null, and its length to dictLength, if that is not null.
+ */
+int inflateGetDictionary(z_stream* strm, uint8_t* dictionary, uint64_t* dictLength)
+{
+    struct inflate_state  *state;
+
+    if (inflateStateCheck(strm)) return Z_STREAM_ERROR;
+    state = (struct inflate_state  *)strm->state;
+    if (state->flat || state->ring) return Z_STREAM_ERROR;
+
+    if (state->whave && dictionary != nullptr) {
+        memcpy(dictionary, state->window + state->wnext,
+                state->whave - state->wnext);
+        memcpy(dictionary + state->whave - state->wnext,
+                state->window, state->wnext);
+    }
+    if (dictLength != nullptr)
+        *dictLength = state->whave;
+    return Z_OK;
+}
+
+/*
+   Set the history that matches may refer to: for a zlib stream when inflate()
+   returned Z_NEED_DICT, or for a raw stream before decoding starts, such as
+   when resuming in the middle of a stream with the output that preceded it.
+ */
+int inflateSetDictionary(z_stream* strm, const uint8_t* dictionary, uint64_t dictLength)
+{
+    struct inflate_state  *state;
+    uint32_t dictid;
+
+    if (inflateStateCheck(strm)) return Z_STREAM_ERROR;
+    state = (struct inflate_state  *)strm->state;
+    if ((state->wrap != 0 && state->mode != DICT) || state->flat || state->ring)
+        return Z_STREAM_ERROR;
+
+    /* check for correct dictionary identifier */
+    if (state->mode == DICT) {
+        dictid = adler32(adler32(0L, nullptr, 0), dictionary, dictLength);
+        if (dictid != state->check)
+            return Z_DATA_ERROR;
+    }
+
+    /* copy dictionary to window using updatewindow(), which will amend the
+       existing dictionary if appropriate */
+    if (updatewindow(strm, dictionary + dictLength, dictLength, 0)) {
+        state->mode = MEM;
+        return Z_MEM_ERROR;
+    }
+    state->havedict = 1;
+    return Z_OK;
+}
+
 int inflateEnd(z_stream* strm)
 {
     struct inflate_state  *state;
     if (inflateStateCheck(strm))
         return Z_STREAM_ERROR;
     state = (struct inflate_state  *)strm->state;
-    if (state->window != nullptr) free(state->window);
+    if (state->window != nullptr && !state->ring) free(state->window);
     free(strm->state);
     strm->state = nullptr;
     return Z_OK;
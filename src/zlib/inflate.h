@@ -91,6 +91,10 @@ struct inflate_state {
     uint64_t whave;             /* valid bytes in the window */
     uint64_t wnext;             /* window write index */
     unsigned char  *window;  /* allocated sliding window, if needed */
+    int flat;                   /* true if the output buffer holds all of the
+                                   output, see inflateNoWindow() */
+    int ring;                   /* true if the output goes straight into the
+                                   window, see inflateBack() */
         /* bit accumulator */
     unsigned long hold;         /* input bit accumulator */
     uint64_t bits;              /* number of bits in "in" */
@@ -104,6 +108,8 @@ struct inflate_state {
     code const  *distcode;   /* starting table for distance codes */
     uint64_t lenbits;           /* index bits for lencode */
     uint64_t distbits;          /* index bits for distcode */
+    code const  *paircode;   /* starting table for inflate_fast() */
+    uint64_t pairbits;          /* index bits for paircode */
         /* dynamic table building */
     uint64_t ncode;             /* number of code length code lengths */
     uint64_t nlen;              /* number of length code lengths */
@@ -113,6 +119,7 @@ struct inflate_state {
     unsigned short lens[320];   /* temporary storage for code lengths */
     unsigned short work[288];   /* work area for code table building */
     code codes[ENOUGH];         /* space for code tables */
+    code pairs[1U << PAIRBITS]; /* space for the literal pair table */
     int sane;                   /* if false, allow invalid distance too far */
     int back;                   /* bits back of last unprocessed length/lit */
     uint64_t was;               /* initial length of match */
@@ -0,0 +1,319 @@
+/* infmark.c -- decode deflate blocks without their window
+ */
+
+/*
+   This decodes deflate blocks that start somewhere in the middle of a stream,
+   so that later parts of a stream can be decoded before the earlier ones, at
+   the same time.  The 32K bytes of output before the starting block are not
+   known yet, so matches that reach back into them produce markers instead:
+   16-bit values that say which byte of that window belongs there.  Once the
+   window is known, replacing the markers gives the output.
+
+   Where blocks start is not known either.  inflate_find_block() searches bit
+   by bit for a dynamic block header that inflate() would accept: the type
+   bits, the code counts, a complete code length code, and literal/length and
+   distance codes that inflate_table() accepts.  Few positions that are not
+   block headers get that far, and decoding the blocks that follow weeds out
+   the rest.
+ */
+
+#include "zutil.h"
+#include "inftrees.h"
+#include "infmark.h"
+
+namespace Zlib {
+
+/* Tables for one block, as in inflate_state. */
+typedef struct {
+    code const  *lencode;    /* starting table for length/literal codes */
+    code const  *distcode;   /* starting table for distance codes */
+    uint64_t lenbits;           /* index bits for lencode */
+    uint64_t distbits;          /* index bits for distcode */
+    unsigned short lens[320];   /* temporary storage for code lengths */
+    unsigned short work[288];   /* work area for code table building */
+    code codes[ENOUGH];         /* space for code tables */
+} block_tables;
+
+static void fixed_tables(block_tables *t)
+{
+#   include "inflate_fixed_tables.h"
+    t->lencode = lenfix;
+    t->lenbits = 9;
+    t->distcode = distfix;
+    t->distbits = 5;
+}
+
+/* Load eight bytes as a little-endian number. */
+static inline uint64_t load64_le(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+/* Return at least 57 bits of in[0..len) from bit pos on, with zeros past the
+   end of the input. */
+static inline uint64_t bits_at(const uint8_t *in, uint64_t len, uint64_t pos)
+{
+    uint64_t at = pos >> 3;
+    uint64_t v = 0;
+    unsigned n;
+
+    if (at + 8 <= len)
+        v = load64_le(in + at);
+    else
+        for (n = 0; at + n < len; n++)
+            v |= (uint64_t)in[at + n] << (8 * n);
+    return v >> (pos & 7);
+}
+
+/* The extra bits of the length or distance in here, from the bits v that start
+   with its code. */
+#define EXTRA(v, here, op) \
+    (unsigned)(((v) & ((1ULL << (here).bits) - 1)) >> ((here).bits - (op)))
+
+/*
+   Read the code lengths of a dynamic block, from bit *pos just after the
+   block type, and build its tables.  Returns 0 with *pos after the code
+   lengths, or -1 if they are invalid.  This does what inflate() does in its
+   TABLE, LENLENS and CODELENS modes, with all of the input at hand.
+ */
+static int dynamic_tables(const uint8_t *in, uint64_t len, uint64_t *pos,
+                          block_tables *t)
+{
+    static const unsigned short order[19] = /* permutation of code lengths */
+        {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    uint64_t p = *pos;
+    uint64_t v;
+    unsigned nlen, ndist, ncode, have, copy, l;
+    code *next;
+    code here;
+
+    v = bits_at(in, len, p);
+    nlen = (unsigned)(v & 31) + 257;
+    ndist = (unsigned)((v >> 5) & 31) + 1;
+    ncode = (unsigned)((v >> 10) & 15) + 4;
+    p += 14;
+    if (nlen > 286 || ndist > 30)
+        return -1;
+    v = bits_at(in, len, p);
+    for (have = 0; have < ncode; have++)
+        t->lens[order[have]] = (unsigned short)((v >> (3 * have)) & 7);
+    for (; have < 19; have++)
+        t->lens[order[have]] = 0;
+    p += 3 * ncode;
+    next = t->codes;
+    t->lencode = next;
+    t->lenbits = 7;
+    if (inflate_table(CODES, t->lens, 19, &next, &t->lenbits, t->work))
+        return -1;
+
+    have = 0;
+    while (have < nlen + ndist) {
+        v = bits_at(in, len, p);
+        here = t->lencode[v & ((1U << t->lenbits) - 1)];
+        p += here.bits;
+        v >>= here.bits;
+        if (here.val < 16) {
+            t->lens[have++] = here.val;
+            continue;
+        }
+        if (here.val == 16) {
+            if (have == 0) return -1;
+            l = t->lens[have - 1];
+            copy = 3 + (unsigned)(v & 3);
+            p += 2;
+        }
+        else if (here.val == 17) {
+            l = 0;
+            copy = 3 + (unsigned)(v & 7);
+            p += 3;
+        }
+        else {
+            l = 0;
+            copy = 11 + (unsigned)(v & 127);
+            p += 7;
+        }
+        if (have + copy > nlen + ndist)
+            return -1;
+        while (copy--)
+            t->lens[have++] = (unsigned short)l;
+    }
+    if (p > len * 8 || t->lens[256] == 0)
+        return -1;
+
+    next = t->codes;
+    t->lencode = next;
+    t->lenbits = 9;
+    if (inflate_table(LENS, t->lens, nlen, &next, &t->lenbits, t->work))
+        return -1;
+    t->distcode = next;
+    t->distbits = 6;
+    if (inflate_table(DISTS, t->lens + nlen, ndist, &next, &t->distbits,
+                      t->work))
+        return -1;
+    *pos = p;
+    return 0;
+}
+
+void inflate_markers_init(uint16_t *out)
+{
+    unsigned n;
+
+    for (n = 0; n < MARKER_WINDOW; n++)
+        out[n] = (uint16_t)(MARKER + n);
+}
+
+int inflate_find_block(const uint8_t *in, uint64_t len, uint64_t *pos)
+{
+    block_tables t;
+    uint64_t p, q, v;
+    unsigned ncode, n, l, kraft;
+
+    for (p = *pos; p < len * 8; p++) {
+        /* not the last block, dynamic codes, and at most 286 literal/length
+           and 30 distance codes */
+        v = bits_at(in, len, p);
+        if ((v & 7) != 4 || ((v >> 3) & 31) > 29 || ((v >> 8) & 31) > 29)
+            continue;
+
+        /* the code length code must be complete */
+        ncode = (unsigned)((v >> 13) & 15) + 4;
+        v = bits_at(in, len, p + 17);
+        kraft = 0;
+        for (n = 0; n < ncode; n++) {
+            l = (unsigned)((v >> (3 * n)) & 7);
+            if (l) kraft += 128U >> l;
+        }
+        if (kraft != 128)
+            continue;
+
+        q = p + 3;
+        if (dynamic_tables(in, len, &q, &t) == 0) {
+            *pos = p;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int inflate_block_type(const uint8_t *in, uint64_t len, uint64_t pos)
+{
+    uint64_t v;
+
+    if (pos + 3 > len * 8)
+        return -1;
+    v = bits_at(in, len, pos);
+    return (int)(((v >> 1) & 3) | ((v & 1) << 2));
+}
+
+/*
+   Like inflate_fast(), this gets a whole literal/length and distance pair
+   from one load of the input, and may copy up to 7 values (16 bytes) past
+   the end of a match.  Hence the MARKER_MIN_LEFT space required in out.
+ */
+int inflate_markers(const uint8_t *in, uint64_t len, uint64_t *pos,
+                    uint16_t *out, uint64_t *have, uint64_t size,
+                    uint64_t low)
+{
+    block_tables t;
+    uint64_t p = *pos;
+    uint64_t h = *have;
+    uint64_t v, at, n, length, dist, i;
+    unsigned lmask, dmask, op;
+    int last, type;
+    code here;
+    uint16_t *to;
+    const uint16_t *from;
+
+    v = bits_at(in, len, p);
+    last = (int)(v & 1);
+    type = (int)((v >> 1) & 3);
+    p += 3;
+    if (p > len * 8)
+        return Z_DATA_ERROR;
+
+    if (type == STORED_BLOCK) {
+        at = (p + 7) >> 3;
+        if (at + 4 > len)
+            return Z_DATA_ERROR;
+        n = in[at] | (in[at + 1] << 8);
+        if (n != ((unsigned)(in[at + 2] | (in[at + 3] << 8)) ^ 0xffff))
+            return Z_DATA_ERROR;
+        at += 4;
+        if (at + n > len)
+            return Z_DATA_ERROR;
+        if (size - h < n)
+            return Z_BUF_ERROR;
+        for (i = 0; i < n; i++)
+            out[h + i] = in[at + i];
+        *pos = (at + n) * 8;
+        *have = h + n;
+        return last ? Z_STREAM_END : Z_OK;
+    }
+    if (type == STATIC_TREES)
+        fixed_tables(&t);
+    else if (type != DYN_TREES || dynamic_tables(in, len, &p, &t))
+        return Z_DATA_ERROR;
+    lmask = (1U << t.lenbits) - 1;
+    dmask = (1U << t.distbits) - 1;
+
+    for (;;) {
+        if (p > len * 8)
+            return Z_DATA_ERROR;
+        if (size - h < MARKER_MIN_LEFT)
+            return Z_BUF_ERROR;
+        v = bits_at(in, len, p);
+        here = t.lencode[v & lmask];
+        if (here.op && (here.op & 0xf0) == 0) {     /* 2nd level code */
+            p += here.bits;
+            v >>= here.bits;
+            here = t.lencode[here.val + (v & ((1U << here.op) - 1))];
+        }
+        p += here.bits;
+        op = here.op;
+        if (op == 0) {                              /* literal */
+            out[h++] = here.val;
+            continue;
+        }
+        if ((op & 16) == 0) {
+            if (op & 32) break;                     /* end-of-block */
+            return Z_DATA_ERROR;
+        }
+        length = here.val + EXTRA(v, here, op & 15);
+        v >>= here.bits;
+        here = t.distcode[v & dmask];
+        if ((here.op & 0xf0) == 0) {                /* 2nd level code */
+            p += here.bits;
+            v >>= here.bits;
+            here = t.distcode[here.val + (v & ((1U << here.op) - 1))];
+        }
+        p += here.bits;
+        op = here.op;
+        if ((op & 16) == 0)
+            return Z_DATA_ERROR;
+        dist = here.val + EXTRA(v, here, op & 15);
+        if (dist > h - low)
+            return Z_DATA_ERROR;
+
+        to = out + h;
+        from = to - dist;
+        if (dist >= 8)
+            for (i = 0; i < length; i += 8)
+                memcpy(to + i, from + i, 8 * sizeof(uint16_t));
+        else
+            for (i = 0; i < length; i++)
+                to[i] = from[i];
+        h += length;
+    }
+    if (p > len * 8)
+        return Z_DATA_ERROR;
+    *pos = p;
+    *have = h;
+    return last ? Z_STREAM_END : Z_OK;
+}
+
+}
@@ -0,0 +1,44 @@
+/* infmark.h -- header to use infmark.c
+ */
+
+/* WARNING: this file should *not* be used by applications. It is
+   part of the implementation of the compression library and is
+   subject to change. Applications should only use zlib.h.
+ */
+
+namespace Zlib {
+
+/* inflate_markers() decodes deflate blocks without knowing the window that
+   precedes them.  Its output is 16-bit: a value below 256 is a byte, and
+   MARKER + i stands for byte i of the unknown MARKER_WINDOW bytes before the
+   output.  The output buffer starts with those MARKER_WINDOW markers, so that
+   matches copy them like any other output. */
+#define MARKER 0x8000
+#define MARKER_WINDOW 32768
+
+/* inflate_markers() needs this much space after the output to decode another
+   symbol; see infmark.c. */
+#define MARKER_MIN_LEFT (258 + 8)
+
+/* Put the MARKER_WINDOW markers at the start of out. */
+void inflate_markers_init (uint16_t *out);
+
+/* Search from bit *pos of in[0..len) for a bit position that holds the header
+   of a non-final block with dynamic codes that inflate() would accept.  Sets
+   *pos to it and returns 1, or returns 0 if there is none. */
+int inflate_find_block (const uint8_t *in, uint64_t len, uint64_t *pos);
+
+/* Return the block type (0, 1 or 2) of the block header at bit pos, plus 4 if
+   it is the last block, or -1 if that is past the end of the input. */
+int inflate_block_type (const uint8_t *in, uint64_t len, uint64_t pos);
+
+/* Decode the block at bit *pos of in[0..len), appending to out[0..size) after
+   *have values.  Distances may reach back to out[low].  On success, returns
+   Z_OK (or Z_STREAM_END for the last block) with *pos and *have advanced past
+   the block.  Returns Z_BUF_ERROR with nothing changed if the block does not
+   fit in out, or Z_DATA_ERROR if the block is invalid or runs out of input. */
+int inflate_markers (const uint8_t *in, uint64_t len, uint64_t *pos,
+                     uint16_t *out, uint64_t *have, uint64_t size,
+                     uint64_t low);
+
+}
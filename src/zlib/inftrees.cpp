@@ -213,6 +213,8 @@ int inflate_table(codetype type, uint16_t* lens, uint64_t codes, code** table, u
         else if (work[sym] >= match) {
             here.op = (unsigned char)(extra[work[sym] - match]);
             here.val = base[work[sym] - match];
+            if ((here.op & 0xf0) == 16)             /* count in extra bits */
+                here.bits += here.op & 15;
         }
         else {
             here.op = (unsigned char)(32 + 64);         /* end of block */
@@ -295,6 +297,41 @@ int inflate_table(codetype type, uint16_t* lens, uint64_t codes, code** table, u
     return 0;
 }
 
+/*
+   Build the table that inflate_fast() starts decoding literal/length codes
+   with, from lencode as built by inflate_table() with lenbits root bits.
+   pairs has 2^PAIRBITS entries.  Where the bits of an index hold two literal
+   codes one after the other, the entry decodes both at once; all others are
+   copies of the lencode root entry for the low lenbits bits of the index, so
+   that links still refer to the sub-tables of lencode.  Text is mostly
+   literals, many of them with codes of five bits or fewer, so this emits
+   about every other literal for free.
+ */
+void inflate_table_pairs(code const* lencode, uint64_t lenbits, code* pairs)
+{
+    unsigned mask;              /* mask for lencode root index */
+    unsigned idx;               /* index into pairs */
+    code here;                  /* first code of the index */
+    code next;                  /* code that follows it */
+
+    mask = (1U << lenbits) - 1;
+    for (idx = 0; idx < (1U << PAIRBITS); idx++) {
+        here = lencode[idx & mask];
+        if (here.op == 0 && here.bits < PAIRBITS) {
+            /* the bits of idx above here.bits that are not known are zero;
+               a code short enough to be decided by the known ones is
+               replicated in lencode whatever the others are */
+            next = lencode[(idx >> here.bits) & mask];
+            if (next.op == 0 && here.bits + next.bits <= PAIRBITS) {
+                here.op = (unsigned char)128;
+                here.bits += next.bits;
+                here.val |= (unsigned short)(next.val << 8);
+            }
+        }
+        pairs[idx] = here;
+    }
+}
+
 }
 
 
@@ -19,7 +19,9 @@ namespace Zlib {
    that table.  For a length or distance, the low four bits of op
    is the number of extra bits to get after the code.  bits is
    the number of bits in this code or part of the code to drop off
-   of the bit buffer.  val is the actual byte to output in the case
+   of the bit buffer; for a length or distance it includes the extra
+   bits, so that inflate_fast() can drop the code and its extra bits
+   with a single shift.  val is the actual byte to output in the case
    of a literal, the base length or distance, or the offset from
    the current table to the next table.  Each entry is four bytes. */
 typedef struct {
@@ -34,8 +36,17 @@ typedef struct {
     0001eeee - length or distance, eeee is the number of extra bits
     01100000 - end of block
     01000000 - invalid code
+    10000000 - two literals, the first in the low byte of val and the
+               second in the high byte (only from inflate_table_pairs())
  */
 
+/* Bits of the code itself in here, without the extra bits that are counted
+   in bits for a length or distance. */
+static inline unsigned code_bits(code here)
+{
+    return here.bits - ((here.op & 0xf0) == 16 ? here.op & 15 : 0);
+}
+
 /* Maximum size of the dynamic table.  The maximum number of code structures is
    1444, which is the sum of 852 for literal/length codes and 592 for distance
    codes.  These values were found by exhaustive searches using the program
@@ -62,5 +73,11 @@ int inflate_table (codetype type, unsigned short  *lens,
                              uint64_t codes, code  *  *table,
                              uint64_t *bits, unsigned short  *work);
 
+/* Index bits of the table built by inflate_table_pairs(). */
+#define PAIRBITS 11
+
+void inflate_table_pairs (code const  *lencode, uint64_t lenbits,
+                                    code  *pairs);
+
 }
 
@@ -217,16 +217,40 @@ static void bi_flush       (deflate_state *s);
     put_byte(s, (uint8_t)((uint16_t)(w) >> 8)); \
 }
 
+/* ===========================================================================
+ * Output a full bit buffer (8 bytes, LSB first) with one unaligned store.
+ * IN assertion: there is enough room in pendingBuf.
+ */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#  define put_uint64(s, w) { \
+    uint64_t w_ = __builtin_bswap64(w); \
+    memcpy(s->pending_buf + s->pending, &w_, 8); \
+    s->pending += 8; \
+}
+#else
+#  define put_uint64(s, w) { \
+    uint64_t w_ = (w); \
+    memcpy(s->pending_buf + s->pending, &w_, 8); \
+    s->pending += 8; \
+}
+#endif
+
+/* ===========================================================================
+ * Send a value on a given number of bits.
+ * IN assertion: length <= 16 and value fits in length bits.
+ * The bit buffer holds up to 63 bits between calls, so the store and its
+ * branch are taken only once every few codes.
+ */
 #define send_bits(s, value, length) \
 { int len = length;\
-  if (s->bi_valid > (int)Buf_size - len) {\
-    int val = (int)value;\
-    s->bi_buf |= (uint16_t)val << s->bi_valid;\
-    put_short(s, s->bi_buf);\
-    s->bi_buf = (uint16_t)val >> (Buf_size - s->bi_valid);\
+  uint64_t val = (uint64_t)(value);\
+  if (s->bi_valid + len >= Buf_size) {\
+    s->bi_buf |= val << s->bi_valid;\
+    put_uint64(s, s->bi_buf);\
+    s->bi_buf = val >> (Buf_size - s->bi_valid);\
     s->bi_valid += len - Buf_size;\
   } else {\
-    s->bi_buf |= (uint16_t)(value) << s->bi_valid;\
+    s->bi_buf |= val << s->bi_valid;\
     s->bi_valid += len;\
   }\
 }
@@ -616,6 +640,63 @@ void _tr_align(deflate_state* s)
     bi_flush(s);
 }
 
+/* ===========================================================================
+ * Compute the cost in bits, extra bits included, of every literal, match
+ * length and distance code when coded with the dynamic trees built for the
+ * given symbol frequencies, or with the static trees if lfreq is null.
+ * lit_cost has LITERALS entries, len_cost MAX_MATCH+1 (indexed by match
+ * length) and dist_cost D_CODES (indexed by distance code). Symbols that
+ * do not occur get the cost of a maximum length code.
+ * This is the cost model of the optimal parser in deflate.c; the trees of
+ * the current block are left untouched.
+ */
+void _tr_costs(deflate_state* s, const uint32_t* lfreq, const uint32_t* dfreq,
+               uint32_t* lit_cost, uint32_t* len_cost, uint32_t* dist_cost)
+{
+    ct_data ltree[HEAP_SIZE];
+    ct_data dtree[2*D_CODES+1];
+    const ct_data *lt = static_ltree;
+    const ct_data *dt = static_dtree;
+    int n;
+
+    if (lfreq != nullptr) {
+        uint32_t max_freq = 1;
+        int shift = 0;
+        tree_desc l_desc = {ltree, 0, &static_l_desc};
+        tree_desc d_desc = {dtree, 0, &static_d_desc};
+        uint32_t opt_len = s->opt_len, static_len = s->static_len;
+
+        /* Freq is 16 bits; scale large counts down keeping them non-zero. */
+        for (n = 0; n < L_CODES; n++) if (lfreq[n] > max_freq) max_freq = lfreq[n];
+        for (n = 0; n < D_CODES; n++) if (dfreq[n] > max_freq) max_freq = dfreq[n];
+        while ((max_freq >> shift) > 0xffff) shift++;
+#define SCALE_FREQ(f) (uint16_t)((f) == 0 ? 0 : ((f) >> shift) ? ((f) >> shift) : 1)
+        for (n = 0; n < L_CODES; n++) ltree[n].Freq = SCALE_FREQ(lfreq[n]);
+        for (n = 0; n < D_CODES; n++) dtree[n].Freq = SCALE_FREQ(dfreq[n]);
+#undef SCALE_FREQ
+        ltree[END_BLOCK].Freq = 1;
+
+        build_tree(s, &l_desc);
+        build_tree(s, &d_desc);
+        s->opt_len = opt_len;
+        s->static_len = static_len;
+        lt = ltree;
+        dt = dtree;
+    }
+
+    for (n = 0; n < LITERALS; n++) {
+        lit_cost[n] = lt[n].Len ? lt[n].Len : MAX_BITS;
+    }
+    for (n = MIN_MATCH; n <= MAX_MATCH; n++) {
+        int code = _length_code[n-MIN_MATCH];
+        int bits = lt[code+LITERALS+1].Len;
+        len_cost[n] = (uint32_t)((bits ? bits : MAX_BITS) + extra_lbits[code]);
+    }
+    for (n = 0; n < D_CODES; n++) {
+        dist_cost[n] = (uint32_t)((dt[n].Len ? dt[n].Len : MAX_BITS) + extra_dbits[n]);
+    }
+}
+
 void _tr_flush_block(deflate_state* s, char* buf, uint32_t stored_len, int last)
 {
     uint32_t opt_lenb, static_lenb; /* opt_len and static_len in bytes */
@@ -805,11 +886,7 @@ static unsigned bi_reverse(unsigned int code, int len)
  */
 static void bi_flush(deflate_state* s)
 {
-    if (s->bi_valid == 16) {
-        put_short(s, s->bi_buf);
-        s->bi_buf = 0;
-        s->bi_valid = 0;
-    } else if (s->bi_valid >= 8) {
+    while (s->bi_valid >= 8) {
         put_byte(s, (uint8_t)s->bi_buf);
         s->bi_buf >>= 8;
         s->bi_valid -= 8;
@@ -821,10 +898,10 @@ static void bi_flush(deflate_state* s)
  */
 static void bi_windup(deflate_state* s)
 {
-    if (s->bi_valid > 8) {
-        put_short(s, s->bi_buf);
-    } else if (s->bi_valid > 0) {
+    while (s->bi_valid > 0) {
         put_byte(s, (uint8_t)s->bi_buf);
+        s->bi_buf >>= 8;
+        s->bi_valid -= 8;
     }
     s->bi_buf = 0;
     s->bi_valid = 0;
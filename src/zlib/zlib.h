@@ -113,6 +113,7 @@ enum CompressionLevel {
   Z_NO_COMPRESSION = 0,
   Z_BEST_SPEED = 1,
   Z_BEST_COMPRESSION = 9,
+  Z_OPTIMAL_COMPRESSION = 10,
   Z_DEFAULT_COMPRESSION = (-1),
 };
 
@@ -136,14 +137,44 @@ extern int deflateInit (z_stream* strm, int level, const char *version = ZLIB_VE
 extern int deflate(z_stream* strm, int flush);
 extern int deflateInit2 (z_stream* strm, int  level, int  method, int windowBits, int memLevel, int strategy, const char *version = ZLIB_VERSION, int stream_size = (int)sizeof(z_stream));
 extern int deflateEnd (z_stream* strm);
+extern int deflateSetDictionary (z_stream* strm, const uint8_t *dictionary, uint32_t dictLength);
+extern int deflateReset (z_stream* strm);
+/* Upper bound on the compressed size of sourceLen bytes, for the parameters
+   strm was initialized with, wrapper included. A single deflate(Z_FINISH)
+   into that much room always completes. */
+extern uint64_t deflateBound (z_stream* strm, uint64_t sourceLen);
+/* The same bound for raw deflate with the default windowBits and memLevel,
+   without a stream to ask: about 0.03% overhead plus a small constant. */
+static constexpr uint64_t deflateRawBound(uint64_t sourceLen) {
+    return sourceLen + (sourceLen >> 12) + (sourceLen >> 14) + (sourceLen >> 25) + 7;
+}
 
 extern int inflateInit2 (z_stream* strm, int  windowBits, const char *version = ZLIB_VERSION, int stream_size = (int)sizeof(z_stream));
 extern int inflateInit (z_stream* strm, const char *version = ZLIB_VERSION, int stream_size = (int)sizeof(z_stream));
 extern int inflate (z_stream* strm, int flush);
 extern int inflateEnd (z_stream* strm);
+extern int inflateReset (z_stream* strm);
+extern int inflateNoWindow (z_stream* strm);
+extern int inflateValidate (z_stream* strm, int check);
+extern int inflatePrime (z_stream* strm, int bits, int value);
+extern int inflateGetDictionary (z_stream* strm, uint8_t *dictionary, uint64_t *dictLength);
+extern int inflateSetDictionary (z_stream* strm, const uint8_t *dictionary, uint64_t dictLength);
+
+typedef uint64_t (*in_func) (void *, const uint8_t **);
+typedef int (*out_func) (void *, uint8_t *, uint64_t);
+/* Size of the window to pass to inflateBackInit(); it is a little larger than
+   the deflate window, which lets inflate write past the end of a match. */
+static constexpr uint64_t inflateBackWindowSize(int windowBits) { return (uint64_t(1) << windowBits) + 15; }
+extern int inflateBackInit (z_stream* strm, int windowBits, uint8_t *window, const char *version = ZLIB_VERSION, int stream_size = (int)sizeof(z_stream));
+extern int inflateBack (z_stream* strm, in_func in, void *in_desc, out_func out, void *out_desc);
+extern int inflateBackEnd (z_stream* strm);
 
 extern uint32_t adler32 (uint32_t adler, const uint8_t *buf, size_t len);
 extern uint32_t crc32 (uint32_t crc, const uint8_t *buf, size_t len);
+extern uint32_t adler32_copy (uint32_t adler, uint8_t *dst, const uint8_t *src, size_t len);
+extern uint32_t crc32_copy (uint32_t crc, uint8_t *dst, const uint8_t *src, size_t len);
+extern uint32_t adler32_combine (uint32_t adler1, uint32_t adler2, uint64_t len2);
+extern uint32_t crc32_combine (uint32_t crc1, uint32_t crc2, uint64_t len2);
 
 }
 
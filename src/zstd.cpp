@@ -1,5 +1,6 @@
 #include <decoco/decoco.hpp>
 #include <zstd.h>
+#include "size_hint.h"
 #include <assert.h>
 #include <iostream>
 
@@ -41,6 +42,19 @@ struct ZstdCompressorS : Compressor {
     if (remainingToFlush) { throw std::runtime_error("Flush incomplete"); }
     return out.subspan(0, output.pos);
   }
+  size_t compressBound(size_t size) const override {
+    return ZSTD_compressBound(size);
+  }
+  std::span<uint8_t> compressInto(std::span<const uint8_t> in, std::span<uint8_t> out) override {
+    // ZSTD_compress2 rather than ZSTD_compressCCtx, which would forget the
+    // checksum flag set on the stream.
+    auto rv = ZSTD_compress2(cstream, out.data(), out.size(), in.data(), in.size());
+    if (ZSTD_isError(rv)) {
+      if (out.size() < ZSTD_compressBound(in.size())) return {};
+      throw std::runtime_error("internal error in zstd");
+    }
+    return out.subspan(0, rv);
+  }
   ~ZstdCompressorS() {
     ZSTD_freeCStream(cstream);
   }
@@ -86,6 +100,21 @@ struct ZstdDecompressorS : Decompressor {
 
 std::unique_ptr<Decompressor> ZstdDecompressor(size_t outputChunkSize) { return std::make_unique<ZstdDecompressorS>(outputChunkSize); }
 
+// Each zstd frame can say how large its content is, and the next frame is
+// found without decompressing this one.
+uint64_t ZstdSizeHint(std::span<const uint8_t> in) {
+  uint64_t total = 0;
+  while (!in.empty()) {
+    unsigned long long size = ZSTD_getFrameContentSize(in.data(), in.size());
+    if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR) return 0;
+    size_t frame = ZSTD_findFrameCompressedSize(in.data(), in.size());
+    if (ZSTD_isError(frame)) return 0;
+    total += size;
+    in = in.subspan(frame);
+  }
+  return total;
+}
+
 }
 
 
@@ -0,0 +1,104 @@
+#include <decoco/decoco.hpp>
+#include <catch2/catch_all.hpp>
+#include "test_data.h"
+
+static std::vector<uint8_t> hello = { 0x68, 0x65, 0x6c, 0x6c, 0x6f, 0x0a };
+
+// One block as bgzip writes it, then the empty block that ends every file.
+static std::vector<uint8_t> helloBgzf = {
+  0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43, 0x02, 0x00, 0x21, 0x00,
+  0xcb, 0x48, 0xcd, 0xc9, 0xc9, 0xe7, 0x02, 0x00, 0x20, 0x30, 0x3a, 0x36, 0x06, 0x00, 0x00, 0x00,
+  0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43, 0x02, 0x00, 0x1b, 0x00,
+  0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+TEST_CASE("Basic roundtrip bgzf") {
+  auto bgzfData = Decoco::compress(Decoco::BgzfCompressor(), hello);
+  REQUIRE(bgzfData == helloBgzf);
+  REQUIRE(Decoco::decompress(Decoco::BgzfDecompressor(), helloBgzf) == hello);
+  REQUIRE(Decoco::gunzip(helloBgzf) == hello);
+  REQUIRE(Decoco::compress(Decoco::FindCompressor("bgzf"), hello) == helloBgzf);
+  REQUIRE(Decoco::decompress(Decoco::FindDecompressor("bgzf"), helloBgzf) == hello);
+  REQUIRE(Decoco::compress(Decoco::BgzfCompressor(), {}) == std::vector<uint8_t>(helloBgzf.begin() + 34, helloBgzf.end()));
+}
+
+TEST_CASE("Bgzf blocks are at most 64 KiB and do not depend on the thread count") {
+  // Some of it incompressible, which has to be stored to fit.
+  auto text = testText(1 << 20, 4242);
+  auto noise = testNoise(200000, 99);
+  std::copy(noise.begin(), noise.end(), text.begin() + 300000);
+  auto one = Decoco::compress(Decoco::BgzfCompressor(Decoco::Compressor::Level::Balanced, 16384, 1), text);
+  auto three = Decoco::compress(Decoco::BgzfCompressor(Decoco::Compressor::Level::Balanced, 16384, 3), text);
+  REQUIRE(one == three);
+
+  auto index = Decoco::BgzfIndex::build(one);
+  // 17 blocks of data, and the empty one at the end.
+  REQUIRE(index.blocks.size() == 17);
+  uint64_t start = 0;
+  for (auto& block : index.blocks) {
+    REQUIRE(block.compressed - start <= 65536);
+    start = block.compressed;
+  }
+  REQUIRE(index.blocks.back().uncompressed == text.size());
+  REQUIRE(std::equal(helloBgzf.begin() + 34, helloBgzf.end(), one.end() - 28));
+
+  REQUIRE(Decoco::decompress(Decoco::BgzfDecompressor(), one) == text);
+  REQUIRE(Decoco::decompress(Decoco::BgzfDecompressor(16384, 4), one) == text);
+  REQUIRE(Decoco::gunzip(one, 0) == text);
+}
+
+TEST_CASE("Bgzf virtual offsets and gzi index") {
+  auto text = testText(1 << 20, 4242);
+  auto bgzfData = Decoco::compress(Decoco::BgzfCompressor(Decoco::Compressor::Level::Fast), text);
+  auto index = Decoco::BgzfIndex::build(bgzfData);
+  auto gzi = index.serialize();
+  REQUIRE(gzi.size() == 8 + 16 * index.blocks.size());
+  REQUIRE(Decoco::BgzfIndex::deserialize(gzi).blocks.size() == index.blocks.size());
+  REQUIRE(Decoco::BgzfIndex::deserialize(hello).blocks.empty());
+
+  Decoco::BgzfReader reader(bgzfData, Decoco::BgzfIndex::deserialize(gzi));
+  // Across a block boundary, back to the start, and to the end.
+  for (uint64_t offset : { uint64_t(0xff00 - 100), uint64_t(0), uint64_t(777777), text.size() - 50, text.size() }) {
+    REQUIRE(reader.seekUncompressed(offset));
+    uint64_t virtualOffset = reader.tell();
+    auto range = reader.read(5000);
+    uint64_t end = std::min<uint64_t>(offset + 5000, text.size());
+    REQUIRE(range == std::vector<uint8_t>(text.begin() + offset, text.begin() + end));
+    // A virtual offset from tell() leads back to the same place.
+    REQUIRE(reader.seek(virtualOffset));
+    REQUIRE(reader.read(100) == std::vector<uint8_t>(text.begin() + offset, text.begin() + std::min<uint64_t>(offset + 100, text.size())));
+  }
+  REQUIRE(reader.seek(uint64_t(index.blocks[2].compressed) << 16 | 10));
+  REQUIRE(reader.read(10) == std::vector<uint8_t>(text.begin() + index.blocks[2].uncompressed + 10, text.begin() + index.blocks[2].uncompressed + 20));
+  REQUIRE(!reader.seek(uint64_t(5) << 16));
+
+  // A block whose trailer claims more output than a block can hold.
+  auto corrupt = helloBgzf;
+  std::fill(corrupt.begin() + 30, corrupt.begin() + 34, 0xff);
+  Decoco::BgzfReader corruptReader(corrupt);
+  REQUIRE(!corruptReader.seek(0));
+  REQUIRE(corruptReader.read(6).empty());
+
+  // Without an index, the reader builds one itself.
+  Decoco::BgzfReader unindexed(bgzfData);
+  REQUIRE(unindexed.read(100) == std::vector<uint8_t>(text.begin(), text.begin() + 100));
+  REQUIRE(unindexed.seekUncompressed(500000));
+  REQUIRE(unindexed.read(100) == std::vector<uint8_t>(text.begin() + 500000, text.begin() + 500100));
+}
+
+TEST_CASE("Bgzf compression and decompression", "[!benchmark]") {
+  auto text = testText(16 << 20, 4242);
+  auto bgzfData = Decoco::compress(Decoco::BgzfCompressor(), text);
+  BENCHMARK("Compress") {
+    return Decoco::compress(Decoco::BgzfCompressor(), text);
+  };
+  BENCHMARK("Compress, all cores") {
+    return Decoco::compress(Decoco::BgzfCompressor(Decoco::Compressor::Level::Balanced, 16384, 0), text);
+  };
+  BENCHMARK("Decompress") {
+    return Decoco::decompress(Decoco::BgzfDecompressor(), bgzfData);
+  };
+  BENCHMARK("Decompress, all cores") {
+    return Decoco::decompress(Decoco::BgzfDecompressor(1 << 20, 0), bgzfData);
+  };
+}
@@ -0,0 +1,41 @@
+#include <decoco/decoco.hpp>
+#include <catch2/catch_all.hpp>
+
+static std::vector<uint8_t> check = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+
+TEST_CASE("Checksums of the standard check string") {
+  REQUIRE(Decoco::Crc32().update(check).value() == 0xcbf43926);
+  REQUIRE(Decoco::Adler32().update(check).value() == 0x091e01de);
+  REQUIRE(Decoco::Crc32().value() == 0);
+  REQUIRE(Decoco::Adler32().value() == 1);
+}
+
+TEST_CASE("Streamed and combined checksums match the whole") {
+  std::vector<uint8_t> data;
+  for (size_t n = 0; n < 100000; n++) data.push_back(uint8_t(n * 7 + (n >> 9)));
+  std::span<const uint8_t> first = std::span(data).subspan(0, 33333), second = std::span(data).subspan(33333);
+
+  Decoco::Crc32 crc;
+  crc.update(first).update({}).update(second);
+  REQUIRE(crc.value() == Decoco::crc32(data));
+  REQUIRE(crc.size() == data.size());
+  REQUIRE(Decoco::Crc32().update(first).combine(Decoco::Crc32().update(second)).value() == crc.value());
+  REQUIRE(Decoco::crc32_combine(Decoco::crc32(first), Decoco::crc32(second), second.size()) == crc.value());
+
+  Decoco::Adler32 adler;
+  adler.update(first).update(second);
+  REQUIRE(adler.value() == Decoco::adler32(data));
+  REQUIRE(Decoco::Adler32().update(first).combine(Decoco::Adler32().update(second)).value() == adler.value());
+  REQUIRE(Decoco::adler32_combine(Decoco::adler32(first), Decoco::adler32(second), second.size()) == adler.value());
+}
+
+TEST_CASE("Checksums over multiple threads") {
+  std::vector<uint8_t> data((5 << 20) + 3);
+  for (size_t n = 0; n < data.size(); n++) data[n] = uint8_t(n ^ (n >> 11));
+  uint32_t crc = Decoco::Crc32().update(data).value();
+  uint32_t adler = Decoco::Adler32().update(data).value();
+  for (size_t threads : { 0, 2, 3, 16 }) {
+    REQUIRE(Decoco::crc32(data, threads) == crc);
+    REQUIRE(Decoco::adler32(data, threads) == adler);
+  }
+}
@@ -1,5 +1,8 @@
 #include <decoco/decoco.hpp>
 #include <catch2/catch_all.hpp>
+#include "test_data.h"
+#include "../src/zlib/zlib.h"
+#include "../src/parallel_inflate.h"
 
 static std::vector<uint8_t> hello = { 0x68, 0x65, 0x6c, 0x6c, 0x6f, 0x0a };
 
@@ -23,3 +26,322 @@ TEST_CASE("Basic GunZIP of hello") {
 }
 
 
+TEST_CASE("Gzip trailer holds the CRC-32 of the input") {
+  // Long enough for the vectorized CRC, with a tail for the scalar one.
+  std::vector<uint8_t> digits;
+  for (size_t n = 0; n < 9005; n++) digits.push_back('1' + n % 9);
+  auto gzData = Decoco::gzip(digits);
+  std::vector<uint8_t> crc(gzData.end() - 8, gzData.end() - 4);
+  REQUIRE(crc == std::vector<uint8_t>{ 0x19, 0x59, 0xa2, 0x92 });
+  REQUIRE(Decoco::gunzip(gzData) == digits);
+}
+
+TEST_CASE("Gunzip of matches at every short distance") {
+  // Repeats of each period up to 40 bytes, so that matches overlap the bytes
+  // they copy, in runs long enough for several chunks.
+  std::vector<uint8_t> data;
+  for (size_t period = 1; period <= 40; period++) {
+    for (size_t n = 0; n < 300; n++) data.push_back(uint8_t('a' + (n % period) + period));
+  }
+  REQUIRE(Decoco::gunzip(Decoco::gzip(data)) == data);
+}
+
+TEST_CASE("Gunzip of more than a window of output") {
+  // Matches reach back across what used to be separate output chunks.
+  auto text = testText(1 << 20, 12345);
+  auto gzData = Decoco::gzip(text);
+  REQUIRE(Decoco::gunzip(gzData) == text);
+  REQUIRE(Decoco::decompress(Decoco::GzipDecompressor(), gzData) == text);
+  auto head = Decoco::gunzip(std::span<const uint8_t>(gzData).first(gzData.size() / 2));
+  REQUIRE(head.size() > 0);
+  REQUIRE(head.size() < text.size());
+  REQUIRE(std::equal(head.begin(), head.end(), text.begin()));
+}
+
+TEST_CASE("Random access into gzip and raw deflate data through an index") {
+  auto text = testText(2 << 20, 12345);
+  for (auto compressed : { Decoco::gzip(text), Decoco::compress(Decoco::DeflateCompressor(Decoco::Compressor::Level::Fast), text) }) {
+    auto index = Decoco::DeflateIndex::build(compressed, 128 << 10);
+    REQUIRE(index.size == text.size());
+    REQUIRE(index.checkpoints.size() >= 8);
+    Decoco::SeekableDecompressor reader(compressed, Decoco::DeflateIndex::deserialize(index.serialize()));
+    REQUIRE(reader.index().checkpoints.size() == index.checkpoints.size());
+    // Backwards, forwards across checkpoints, continuing, and past the end.
+    for (uint64_t offset : { uint64_t(1500000), uint64_t(0), uint64_t(333333), uint64_t(338333), uint64_t(1 << 20), text.size() - 1000, text.size() }) {
+      auto range = reader.read(offset, 5000);
+      uint64_t end = std::min<uint64_t>(offset + 5000, text.size());
+      REQUIRE(range == std::vector<uint8_t>(text.begin() + offset, text.begin() + end));
+    }
+  }
+  REQUIRE(Decoco::DeflateIndex::deserialize(hello).checkpoints.empty());
+}
+
+// Gzip data at a zlib level, which reaches the levels that have no
+// Compressor::Level of their own.
+static std::vector<uint8_t> gzipAtLevel(std::span<const uint8_t> in, int level) {
+  Zlib::z_stream strm = {};
+  REQUIRE(Zlib::deflateInit2(&strm, level, Zlib::Z_DEFLATED, 31, 8, Zlib::Z_DEFAULT_STRATEGY) == Zlib::Z_OK);
+  std::vector<uint8_t> out(Zlib::deflateBound(&strm, in.size()));
+  strm.next_in = in.data();
+  strm.avail_in = in.size();
+  strm.next_out = out.data();
+  strm.avail_out = out.size();
+  REQUIRE(Zlib::deflate(&strm, Zlib::Z_FINISH) == Zlib::Z_STREAM_END);
+  out.resize(strm.total_out);
+  Zlib::deflateEnd(&strm);
+  return out;
+}
+
+TEST_CASE("Gzip Small level roundtrips and does not lose to level 9") {
+  auto text = testText(256 << 10, 12345);
+  auto best = gzipAtLevel(text, Zlib::Z_BEST_COMPRESSION);
+  auto small = Decoco::compress(Decoco::GzipCompressor(Decoco::Compressor::Level::Small), text);
+  REQUIRE(small.size() <= best.size());
+  REQUIRE(Decoco::decompress(Decoco::GzipDecompressor(), small) == text);
+}
+
+TEST_CASE("Parallel gzip output does not depend on the thread count") {
+  auto text = testText(1 << 20, 12345);
+  auto two = Decoco::compress(Decoco::GzipCompressor(Decoco::Compressor::Level::Balanced, 16384, 2), text);
+  auto five = Decoco::compress(Decoco::GzipCompressor(Decoco::Compressor::Level::Balanced, 16384, 5), text);
+  REQUIRE(two == five);
+  // One thread, or one per core on whatever machine this runs, are no different.
+  REQUIRE(Decoco::compress(Decoco::GzipCompressor(Decoco::Compressor::Level::Balanced, 16384, 1), text) == two);
+  REQUIRE(Decoco::compress(Decoco::GzipCompressor(Decoco::Compressor::Level::Balanced, 16384, 0), text) == two);
+  for (auto make : { +[](size_t threads) { return Decoco::ZlibCompressor(Decoco::Compressor::Level::Fast, 16384, threads); }, +[](size_t threads) { return Decoco::DeflateCompressor(Decoco::Compressor::Level::Fast, 16384, threads); } }) {
+    REQUIRE(Decoco::compress(make(1), text) == Decoco::compress(make(3), text));
+  }
+
+  // Input after the end of the stream is not taken.
+  auto ended = Decoco::GzipCompressor(Decoco::Compressor::Level::Balanced, 16384, 2);
+  auto stream = ended->compress(hello);
+  auto end = ended->flush();
+  stream.insert(stream.end(), end.begin(), end.end());
+  REQUIRE(ended->compress(hello).empty());
+  REQUIRE(ended->flush().empty());
+  REQUIRE(Decoco::gunzip(stream) == hello);
+  REQUIRE(Decoco::decompress(Decoco::GzipDecompressor(), two) == text);
+  REQUIRE(Decoco::gunzip(Decoco::compress(Decoco::GzipCompressor(Decoco::Compressor::Level::Balanced, 16384, 2), hello)) == hello);
+}
+
+TEST_CASE("Gzip compression of large inputs", "[!benchmark]") {
+  // 16 MiB slides the 32 KiB window 512 times, so window management shows up
+  // next to matching and entropy coding.
+  auto text = testText(16 << 20, 12345);
+  BENCHMARK("Fast") {
+    return Decoco::compress(Decoco::GzipCompressor(Decoco::Compressor::Level::Fast), text);
+  };
+  BENCHMARK("Balanced") {
+    return Decoco::compress(Decoco::GzipCompressor(Decoco::Compressor::Level::Balanced), text);
+  };
+  BENCHMARK("Balanced, all cores") {
+    return Decoco::compress(Decoco::GzipCompressor(Decoco::Compressor::Level::Balanced, 16384, 0), text);
+  };
+}
+
+TEST_CASE("Gzip Small against level 9", "[!benchmark]") {
+  // Optimal parsing trades CPU time for size; report both so the trade-off
+  // is visible next to the timings. Level 9 is the best zlib does without it.
+  auto text = testText(4 << 20, 12345);
+  WARN("Level 9: " << gzipAtLevel(text, Zlib::Z_BEST_COMPRESSION).size() << " bytes");
+  WARN("Small: " << Decoco::compress(Decoco::GzipCompressor(Decoco::Compressor::Level::Small), text).size() << " bytes");
+  BENCHMARK("Level 9") {
+    return gzipAtLevel(text, Zlib::Z_BEST_COMPRESSION);
+  };
+  BENCHMARK("Small") {
+    return Decoco::compress(Decoco::GzipCompressor(Decoco::Compressor::Level::Small), text);
+  };
+}
+
+static std::vector<uint8_t> letterSoup(size_t size) {
+  // Letters in about their English frequencies, but no words, so that there
+  // is little to match and decoding is mostly literals.
+  static const char letters[] = "eeeeeeeeeeeetttttttttaaaaaaaaoooooooiiiiiiinnnnnnnssssssshhhhhhrrrrrrddddlllluuucccmmmwwffggyyppbbvk        \n";
+  auto text = testNoise(size, 54321);
+  for (auto& c : text) c = letters[c % (sizeof(letters) - 1)];
+  return text;
+}
+
+TEST_CASE("Gunzip on multiple threads gives the same output") {
+  // Over 3 MiB compressed, so that it is split up, and some of it incompressible.
+  auto text = letterSoup(5 << 20);
+  for (size_t n = 0; n < (1 << 20); n++) text[(3 << 20) + n] = uint8_t(n * 2654435761u >> 13);
+  auto gzData = Decoco::gzip(text);
+  REQUIRE(Decoco::gunzip(gzData, 4) == text);
+  REQUIRE(Decoco::gunzip(gzData, 0) == text);
+  auto parallel = Decoco::compress(Decoco::GzipCompressor(Decoco::Compressor::Level::Fast, 16384, 2), text);
+  REQUIRE(Decoco::gunzip(parallel, 3) == text);
+  REQUIRE(Decoco::gunzip(helloGzip, 4) == hello);
+}
+
+TEST_CASE("Gunzip on multiple threads splits up data from every level") {
+  // Split up is what is tested, so it must succeed rather than fall back.
+  auto text = letterSoup(5 << 20);
+  for (size_t n = 0; n < (1 << 20); n++) text[(3 << 20) + n] = uint8_t(n * 2654435761u >> 13);
+  for (int level : { 1, 6, 9 }) {
+    auto gzData = gzipAtLevel(text, level);
+    std::vector<uint8_t> out;
+    REQUIRE(Decoco::ParallelGunzip(gzData, 4, out));
+    REQUIRE(out == text);
+  }
+
+  // A trailer that does not match the output is not taken.
+  auto gzData = gzipAtLevel(text, 6);
+  std::vector<uint8_t> out;
+  auto badCrc = gzData;
+  badCrc[badCrc.size() - 8] ^= 1;
+  REQUIRE(!Decoco::ParallelGunzip(badCrc, 4, out));
+  auto badSize = gzData;
+  badSize[badSize.size() - 4] ^= 1;
+  REQUIRE(!Decoco::ParallelGunzip(badSize, 4, out));
+}
+
+// Feed in to d a piece at a time, taking out all output after each piece.
+static std::vector<uint8_t> decompressInPieces(Decoco::Decompressor& d, std::span<const uint8_t> in, size_t piece) {
+  std::vector<uint8_t> out, buffer(16384);
+  for (size_t pos = 0; pos < in.size(); pos += piece) {
+    auto chunk = d.decompress(in.subspan(pos, std::min(piece, in.size() - pos)), buffer);
+    while (!chunk.empty()) {
+      out.insert(out.end(), chunk.begin(), chunk.end());
+      chunk = d.decompress({}, buffer);
+    }
+  }
+  return out;
+}
+
+TEST_CASE("Gzip members one after the other decompress to their joined output") {
+  // As `cat a.gz b.gz c.gz` would make, from both kinds of compressor, with
+  // zero padding after the last member.
+  auto text = testText(1 << 20, 12345);
+  auto soup = letterSoup(300000);
+  auto gzData = Decoco::gzip(text);
+  gzData.insert(gzData.end(), helloGzip.begin(), helloGzip.end());
+  auto parallel = Decoco::compress(Decoco::GzipCompressor(Decoco::Compressor::Level::Fast, 16384, 2), soup);
+  gzData.insert(gzData.end(), parallel.begin(), parallel.end());
+  auto joined = text;
+  joined.insert(joined.end(), hello.begin(), hello.end());
+  joined.insert(joined.end(), soup.begin(), soup.end());
+  auto padded = gzData;
+  padded.resize(padded.size() + 512);
+
+  REQUIRE(Decoco::gunzip(gzData) == joined);
+  REQUIRE(Decoco::gunzip(padded) == joined);
+  REQUIRE(Decoco::gunzip(gzData, 3) == joined);
+  REQUIRE(Decoco::gunzip(padded, 0) == joined);
+  for (size_t threads : { 1, 2, 4 }) {
+    REQUIRE(Decoco::decompress(Decoco::GzipDecompressor(16384, threads), padded) == joined);
+    for (size_t piece : { 1000, 65536, 700000 }) {
+      auto decompressor = Decoco::GzipDecompressor(16384, threads);
+      REQUIRE(decompressInPieces(*decompressor, gzData, piece) == joined);
+    }
+  }
+
+  // Many small members, so that each run of them holds several.
+  std::vector<uint8_t> members;
+  for (size_t n = 0; n < text.size(); n += 10000) {
+    auto member = Decoco::gzip(std::span<const uint8_t>(text).subspan(n, std::min<size_t>(10000, text.size() - n)));
+    members.insert(members.end(), member.begin(), member.end());
+  }
+  REQUIRE(Decoco::gunzip(members) == text);
+  REQUIRE(Decoco::gunzip(members, 4) == text);
+  auto decompressor = Decoco::GzipDecompressor(16384, 2);
+  REQUIRE(decompressInPieces(*decompressor, members, 300000) == text);
+
+  // Incompressible data is stored as it is, so a header in it is cut at too.
+  auto noise = testNoise(400000, 777);
+  std::copy(helloGzip.begin(), helloGzip.begin() + 10, noise.begin() + 200000);
+  auto fake = Decoco::gzip(noise);
+  REQUIRE(std::search(fake.begin(), fake.end(), helloGzip.begin(), helloGzip.begin() + 10) != fake.end());
+  fake.insert(fake.end(), helloGzip.begin(), helloGzip.end());
+  noise.insert(noise.end(), hello.begin(), hello.end());
+  REQUIRE(Decoco::gunzip(fake, 2) == noise);
+}
+
+TEST_CASE("Pipelined gzip decompression gives the same output and checks every member") {
+  auto text = testText(1 << 20, 12345);
+  auto gzData = Decoco::gzip(text);
+  auto members = gzData;
+  members.insert(members.end(), helloGzip.begin(), helloGzip.end());
+  members.insert(members.end(), gzData.begin(), gzData.end());
+  auto joined = text;
+  joined.insert(joined.end(), hello.begin(), hello.end());
+  joined.insert(joined.end(), text.begin(), text.end());
+  auto padded = members;
+  padded.resize(padded.size() + 512);
+
+  REQUIRE(Decoco::decompress(Decoco::PipelinedGzipDecompressor(), helloGzip) == hello);
+  REQUIRE(Decoco::decompress(Decoco::PipelinedGzipDecompressor(), gzData) == text);
+  REQUIRE(Decoco::decompress(Decoco::PipelinedGzipDecompressor(1 << 20), padded) == joined);
+  for (size_t piece : { 1, 1000, 65536, 700000 }) {
+    auto decompressor = Decoco::PipelinedGzipDecompressor();
+    auto input = std::span<const uint8_t>(padded).first(piece == 1 ? 5000 : padded.size());
+    auto expected = Decoco::decompress(Decoco::GzipDecompressor(), input);
+    REQUIRE(decompressInPieces(*decompressor, input, piece) == expected);
+    REQUIRE(decompressor->bytesUsed() == std::min(input.size(), members.size()));
+  }
+
+  // A wrong CRC-32 in the second member stops the output at that member.
+  auto corrupt = members;
+  corrupt[gzData.size() + helloGzip.size() - 8] ^= 1;
+  auto decompressor = Decoco::PipelinedGzipDecompressor();
+  auto out = Decoco::decompress(*decompressor, corrupt);
+  REQUIRE(decompressor->bytesUsed() == gzData.size());
+  REQUIRE(out.size() >= text.size());
+  REQUIRE(std::equal(text.begin(), text.end(), out.begin()));
+  REQUIRE(decompressor->decompress(gzData).empty());
+}
+
+TEST_CASE("Gunzip of literal-heavy text", "[!benchmark]") {
+  auto text = letterSoup(16 << 20);
+  auto gzData = Decoco::gzip(text);
+  REQUIRE(Decoco::gunzip(gzData) == text);
+  BENCHMARK("Gunzip") {
+    return Decoco::gunzip(gzData);
+  };
+  BENCHMARK("Gunzip, all cores") {
+    return Decoco::gunzip(gzData, 0);
+  };
+  BENCHMARK("Stream") {
+    return Decoco::decompress(Decoco::GzipDecompressor(), gzData);
+  };
+  BENCHMARK("Stream, pipelined") {
+    return Decoco::decompress(Decoco::PipelinedGzipDecompressor(), gzData);
+  };
+}
+
+TEST_CASE("Gzip range read through an index against a full gunzip", "[!benchmark]") {
+  auto text = testText(16 << 20, 12345);
+  auto gzData = Decoco::gzip(text);
+  auto index = Decoco::DeflateIndex::build(gzData);
+  WARN("Index: " << index.checkpoints.size() << " checkpoints, " << index.serialize().size() << " bytes");
+  BENCHMARK("Build index") {
+    return Decoco::DeflateIndex::build(gzData);
+  };
+  BENCHMARK("Gunzip") {
+    return Decoco::gunzip(gzData);
+  };
+  Decoco::SeekableDecompressor reader(gzData, index);
+  uint64_t offset = 0;
+  BENCHMARK("Read 64 KiB at a new offset") {
+    offset = (offset + 5000017) % (text.size() - 65536);
+    return reader.read(offset, 65536);
+  };
+}
+
+TEST_CASE("Gunzip of many members", "[!benchmark]") {
+  // 64 KiB members, as block-compressed formats use.
+  auto text = testText(16 << 20, 12345);
+  std::vector<uint8_t> members;
+  for (size_t n = 0; n < text.size(); n += 65536) {
+    auto member = Decoco::gzip(std::span<const uint8_t>(text).subspan(n, 65536));
+    members.insert(members.end(), member.begin(), member.end());
+  }
+  REQUIRE(Decoco::gunzip(members, 0) == text);
+  BENCHMARK("Gunzip") {
+    return Decoco::gunzip(members);
+  };
+  BENCHMARK("Gunzip, all cores") {
+    return Decoco::gunzip(members, 0);
+  };
+}
+
@@ -0,0 +1,35 @@
+#include <decoco/decoco.hpp>
+#include <catch2/catch_all.hpp>
+#include <algorithm>
+#include "test_data.h"
+
+TEST_CASE("Kernel variants are reported") {
+  auto list = Decoco::kernels();
+  REQUIRE(list.size() == 5);
+  for (auto& k : list) {
+    REQUIRE(!k.supported.empty());
+    REQUIRE(std::find(k.supported.begin(), k.supported.end(), k.active) != k.supported.end());
+    // Every kernel has portable code, which DECOCO_KERNELS=c selects.
+    REQUIRE(std::find(k.supported.begin(), k.supported.end(), "c") != k.supported.end());
+  }
+  REQUIRE(!Decoco::forceKernel("crc32", "no-such-variant"));
+  REQUIRE(!Decoco::forceKernel("no-such-kernel", ""));
+}
+
+TEST_CASE("All kernel variants produce the same output") {
+  auto data = testText(300000, 1);
+  auto gz = Decoco::gzip(data);
+  auto z = Decoco::compress(Decoco::ZlibCompressor(), data);
+
+  for (auto& k : Decoco::kernels()) {
+    for (auto variant : k.supported) {
+      INFO(k.name << "=" << variant);
+      REQUIRE(Decoco::forceKernel(k.name, variant));
+      REQUIRE(Decoco::gzip(data) == gz);
+      REQUIRE(Decoco::compress(Decoco::ZlibCompressor(), data) == z);
+      REQUIRE(Decoco::gunzip(gz) == data);
+      REQUIRE(Decoco::decompress(Decoco::ZlibDecompressor(), z) == data);
+    }
+    REQUIRE(Decoco::forceKernel(k.name, ""));
+  }
+}
@@ -1,5 +1,6 @@
 #include <decoco/decoco.hpp>
 #include <catch2/catch_all.hpp>
+#include "test_data.h"
 
 TEST_CASE("Short-form roundtrip zlib") {
   std::string blob = "hello\n";
@@ -11,3 +12,191 @@ TEST_CASE("Short-form roundtrip zlib") {
   REQUIRE(buffer == Decoco::decompress(Decoco::ZlibDecompressor(), compressedData));
 }
 
+
+TEST_CASE("One-shot compression fits in compressBound and decompresses") {
+  // Incompressible input over several parallel deflate blocks is the worst case.
+  auto random = testNoise(300000, 17);
+  auto text = testText(65536, 1);
+  using Level = Decoco::Compressor::Level;
+  for (auto level : { Level::Fast, Level::Balanced, Level::Small }) {
+    std::vector<std::pair<std::string_view, std::unique_ptr<Decoco::Compressor>>> compressors;
+    for (std::string_view name : { "gzip", "zlib", "deflate", "bgzf" }) {
+      compressors.emplace_back(name, Decoco::FindCompressor(name, level));
+    }
+    compressors.emplace_back("gzip", Decoco::GzipCompressor(level, 16384, 3));
+    compressors.emplace_back("deflate", Decoco::DeflateCompressor(level, 16384, 3));
+    // The other libraries give their own bounds, which are the same for all levels.
+    if (level == Level::Balanced) {
+      for (std::string_view name : { "bzip2", "lzma", "brotli" }) {
+        compressors.emplace_back(name, Decoco::FindCompressor(name, level));
+      }
+    }
+    for (auto& [name, compressor] : compressors) {
+      INFO(name << ", level " << int(level));
+      for (size_t size : { 0, 1, 6, 65536, 300000 }) {
+        INFO(size << " bytes");
+        std::span<const uint8_t> in(random.data(), size);
+        std::vector<uint8_t> out(compressor->compressBound(size));
+        auto packed = compressor->compressInto(in, out);
+        REQUIRE(!packed.empty());
+        REQUIRE(packed.data() == out.data());
+        REQUIRE(Decoco::decompress(Decoco::FindDecompressor(name), packed) == std::vector<uint8_t>(in.begin(), in.end()));
+      }
+      if (level != Level::Balanced) continue;
+      // Without room for all of it, nothing is returned, and the compressor
+      // can be used again.
+      std::vector<uint8_t> out(compressor->compressBound(text.size()));
+      size_t size = compressor->compressInto(text, out).size();
+      REQUIRE(size < text.size() / 2);
+      REQUIRE(Decoco::decompress(Decoco::FindDecompressor(name), std::span<const uint8_t>(out).first(size)) == text);
+      REQUIRE(compressor->compressInto(text, std::span<uint8_t>(out).first(size - 1)).empty());
+      REQUIRE(compressor->compressInto(text, {}).empty());
+      REQUIRE(compressor->compressInto(text, out).size() == size);
+    }
+  }
+}
+
+TEST_CASE("One-shot deflate gives the same output as streaming") {
+  auto text = testText(300000, 2);
+  for (auto& make : { +[]{ return Decoco::GzipCompressor(); }, +[]{ return Decoco::ZlibCompressor(); }, +[]{ return Decoco::DeflateCompressor(Decoco::Compressor::Level::Fast); }, +[]{ return Decoco::GzipCompressor(Decoco::Compressor::Level::Balanced, 16384, 2); } }) {
+    auto streaming = make();
+    std::vector<uint8_t> expected = streaming->compress(text);
+    auto end = streaming->flush();
+    expected.insert(expected.end(), end.begin(), end.end());
+    REQUIRE(Decoco::compress(make(), text) == expected);
+  }
+}
+
+TEST_CASE("Compression of many small objects", "[!benchmark]") {
+  std::vector<std::vector<uint8_t>> objects;
+  for (uint32_t n = 0; n < 10000; n++) objects.push_back(testText(200 + n % 3000, n));
+  for (std::string_view name : { "gzip", "zstd", "lzma", "brotli" }) {
+    auto compressor = Decoco::FindCompressor(name, Decoco::Compressor::Level::Fast);
+    BENCHMARK(std::string(name) + ", streaming") {
+      size_t total = 0;
+      for (auto& object : objects) {
+        auto c = Decoco::FindCompressor(name, Decoco::Compressor::Level::Fast);
+        total += c->compress(object).size() + c->flush().size();
+      }
+      return total;
+    };
+    BENCHMARK(std::string(name) + ", one compressor, one shot") {
+      std::vector<uint8_t> out;
+      size_t total = 0;
+      for (auto& object : objects) {
+        out.resize(compressor->compressBound(object.size()));
+        total += compressor->compressInto(object, out).size();
+      }
+      return total;
+    };
+  }
+}
+
+TEST_CASE("Decompressed size hints come from the data") {
+  auto text = testText(200000, 3);
+  auto gzData = Decoco::gzip(text);
+  REQUIRE(Decoco::decompressedSizeHint(gzData) == text.size());
+  // Only the last gzip member is found, but all BGZF blocks are.
+  auto two = gzData;
+  auto hello = Decoco::gzip(std::span<const uint8_t>(text).first(6));
+  two.insert(two.end(), hello.begin(), hello.end());
+  REQUIRE(Decoco::decompressedSizeHint(two) == 6);
+  REQUIRE(Decoco::decompressedSizeHint(Decoco::compress(Decoco::BgzfCompressor(), text)) == text.size());
+
+  // Each xz stream has an index, and padding may follow them.
+  auto xzData = Decoco::xzip(text);
+  REQUIRE(Decoco::decompressedSizeHint(xzData) == text.size());
+  auto streams = xzData;
+  streams.insert(streams.end(), 8, 0);
+  auto small = Decoco::xzip(std::span<const uint8_t>(text).first(1000));
+  streams.insert(streams.end(), small.begin(), small.end());
+  REQUIRE(Decoco::decompressedSizeHint(streams) == text.size() + 1000);
+  REQUIRE(Decoco::decompressedSizeHint(std::span<const uint8_t>(xzData).first(xzData.size() - 1)) == 0);
+
+  REQUIRE(Decoco::decompressedSizeHint(Decoco::bzip2(text)) == 0);
+  REQUIRE(Decoco::decompressedSizeHint({}) == 0);
+  REQUIRE(Decoco::decompressedSizeHint(std::span<const uint8_t>(gzData).first(2)) == 0);
+}
+
+TEST_CASE("Decompression does not depend on the size the data gives") {
+  auto text = testText(200000, 4);
+  auto gzData = Decoco::gzip(text);
+  // Garbage after the data, which gzip ignores, looks like a trailer that
+  // gives too much or too little.
+  for (uint8_t last : { 0x00, 0x01, 0xff }) {
+    auto padded = gzData;
+    padded.insert(padded.end(), { 0xff, 0x00, 0x00, last });
+    REQUIRE(Decoco::decompress(Decoco::GzipDecompressor(), padded) == text);
+  }
+  auto two = gzData;
+  two.insert(two.end(), gzData.begin(), gzData.end());
+  auto twice = text;
+  twice.insert(twice.end(), text.begin(), text.end());
+  REQUIRE(Decoco::decompress(Decoco::GzipDecompressor(), two) == twice);
+  for (size_t size : { 0, 1, 32767, 32768, 32769, 65536 }) {
+    std::span<const uint8_t> in(text.data(), size);
+    REQUIRE(Decoco::decompress(Decoco::GzipDecompressor(), Decoco::gzip(in)) == std::vector<uint8_t>(in.begin(), in.end()));
+    REQUIRE(Decoco::decompress(Decoco::LzmaDecompressor(), Decoco::xzip(in)) == std::vector<uint8_t>(in.begin(), in.end()));
+    REQUIRE(Decoco::decompress(Decoco::Bzip2Decompressor(), Decoco::bzip2(in)) == std::vector<uint8_t>(in.begin(), in.end()));
+  }
+}
+
+TEST_CASE("Output handed to a sink is the same as collected in a vector") {
+  auto text = testText(300000, 5);
+  std::span<const uint8_t> first = std::span<const uint8_t>(text).first(100000), rest = std::span<const uint8_t>(text).subspan(100000);
+  for (std::string_view name : { "gzip", "zlib", "bzip2", "lzma", "brotli" }) {
+    INFO(name);
+    std::vector<uint8_t> compressed;
+    size_t largest = 0;
+    auto collect = [&](std::span<const uint8_t> piece) {
+      largest = std::max(largest, piece.size());
+      compressed.insert(compressed.end(), piece.begin(), piece.end());
+    };
+    auto compressor = Decoco::FindCompressor(name, Decoco::Compressor::Level::Fast, 4096);
+    compressor->compress(first, collect);
+    compressor->compress(rest, collect);
+    compressor->flush(collect);
+    REQUIRE(largest <= 4096);
+
+    auto other = Decoco::FindCompressor(name, Decoco::Compressor::Level::Fast, 4096);
+    auto expected = other->compress(first);
+    for (auto& piece : { other->compress(rest), other->flush() }) expected.insert(expected.end(), piece.begin(), piece.end());
+    REQUIRE(compressed == expected);
+
+    std::vector<uint8_t> out;
+    size_t pieces = 0;
+    Decoco::FindDecompressor(name, 4096)->decompress(compressed, [&](std::span<const uint8_t> piece) {
+      REQUIRE(!piece.empty());
+      REQUIRE(piece.size() <= 4096);
+      pieces++;
+      out.insert(out.end(), piece.begin(), piece.end());
+    });
+    REQUIRE(out == text);
+    REQUIRE(pieces >= text.size() / 4096);
+  }
+}
+
+TEST_CASE("Streaming into a sink against into vectors", "[!benchmark]") {
+  auto text = testText(16 << 20, 6);
+  auto gzData = Decoco::gzip(text);
+  BENCHMARK("Compress to vector") {
+    auto compressor = Decoco::GzipCompressor(Decoco::Compressor::Level::Fast);
+    return compressor->compress(text).size() + compressor->flush().size();
+  };
+  BENCHMARK("Compress to sink") {
+    auto compressor = Decoco::GzipCompressor(Decoco::Compressor::Level::Fast);
+    size_t total = 0;
+    auto count = [&total](std::span<const uint8_t> piece) { total += piece.size(); };
+    compressor->compress(text, count);
+    compressor->flush(count);
+    return total;
+  };
+  BENCHMARK("Decompress to vector") {
+    return Decoco::GzipDecompressor()->decompress(gzData).size();
+  };
+  BENCHMARK("Decompress to sink") {
+    size_t total = 0;
+    Decoco::GzipDecompressor()->decompress(gzData, [&total](std::span<const uint8_t> piece) { total += piece.size(); });
+    return total;
+  };
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Input for the tests, the same every run for the same seed.
+
+// Words and numbers in the way of a server log, which compresses about as
+// well as text does.
+inline std::vector<uint8_t> testText(size_t size, uint32_t seed) {
+  static const char* words[] = { "GET ", "POST ", "/api/v1/users ", "200 ", "404 ", "INFO ", "WARN ", "request ", "latency_ms=", "user_id=", "session ", "\n" };
+  std::vector<uint8_t> text;
+  while (text.size() < size) {
+    seed = seed * 1103515245 + 12345;
+    for (const char* w = words[(seed >> 16) % 12]; *w; w++) text.push_back(*w);
+    if ((seed >> 8) % 4 == 0) {
+      for (char c : std::to_string((seed >> 4) % 100000)) text.push_back(c);
+    }
+  }
+  text.resize(size);
+  return text;
+}
+
+// Bytes that do not compress.
+inline std::vector<uint8_t> testNoise(size_t size, uint32_t seed) {
+  std::vector<uint8_t> data(size);
+  for (auto& byte : data) {
+    seed = seed * 1103515245 + 12345;
+    byte = uint8_t(seed >> 16);
+  }
+  return data;
+}
@@ -0,0 +1,150 @@
+#include <decoco/decoco.hpp>
+#include <catch2/catch_all.hpp>
+#include "test_data.h"
+
+static std::vector<uint8_t> hello = { 0x68, 0x65, 0x6c, 0x6c, 0x6f, 0x0a };
+
+// As Python's zipfile writes it: hello.txt deflated, dir/stored.bin stored, and
+// a comment after the end of central directory record.
+static std::vector<uint8_t> pythonZip = {
+  0x50, 0x4b, 0x03, 0x04, 0x14, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x60, 0xa1, 0x52, 0x3a, 0x37, 0x66, 0x3d,
+  0x0a, 0x00, 0x00, 0x00, 0x12, 0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x68, 0x65, 0x6c, 0x6c, 0x6f, 0x2e,
+  0x74, 0x78, 0x74, 0xcb, 0x48, 0xcd, 0xc9, 0xc9, 0xe7, 0xca, 0x40, 0x22, 0x01, 0x50, 0x4b, 0x03, 0x04, 0x14,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x60, 0xa1, 0x52, 0x20, 0x30, 0x3a, 0x36, 0x06, 0x00, 0x00, 0x00, 0x06,
+  0x00, 0x00, 0x00, 0x0e, 0x00, 0x00, 0x00, 0x64, 0x69, 0x72, 0x2f, 0x73, 0x74, 0x6f, 0x72, 0x65, 0x64, 0x2e,
+  0x62, 0x69, 0x6e, 0x68, 0x65, 0x6c, 0x6c, 0x6f, 0x0a, 0x50, 0x4b, 0x01, 0x02, 0x14, 0x03, 0x14, 0x00, 0x00,
+  0x00, 0x08, 0x00, 0x00, 0x60, 0xa1, 0x52, 0x3a, 0x37, 0x66, 0x3d, 0x0a, 0x00, 0x00, 0x00, 0x12, 0x00, 0x00,
+  0x00, 0x09, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x01, 0x00, 0x00, 0x00,
+  0x00, 0x68, 0x65, 0x6c, 0x6c, 0x6f, 0x2e, 0x74, 0x78, 0x74, 0x50, 0x4b, 0x01, 0x02, 0x14, 0x03, 0x14, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x60, 0xa1, 0x52, 0x20, 0x30, 0x3a, 0x36, 0x06, 0x00, 0x00, 0x00, 0x06, 0x00,
+  0x00, 0x00, 0x0e, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x01, 0x31, 0x00,
+  0x00, 0x00, 0x64, 0x69, 0x72, 0x2f, 0x73, 0x74, 0x6f, 0x72, 0x65, 0x64, 0x2e, 0x62, 0x69, 0x6e, 0x50, 0x4b,
+  0x05, 0x06, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x02, 0x00, 0x73, 0x00, 0x00, 0x00, 0x63, 0x00, 0x00, 0x00,
+  0x0e, 0x00, 0x6d, 0x61, 0x64, 0x65, 0x20, 0x62, 0x79, 0x20, 0x70, 0x79, 0x74, 0x68, 0x6f, 0x6e,
+};
+
+static std::vector<uint8_t> join(const std::vector<std::vector<uint8_t>>& pieces) {
+  std::vector<uint8_t> out;
+  for (auto& piece : pieces) out.insert(out.end(), piece.begin(), piece.end());
+  return out;
+}
+
+TEST_CASE("Reading a ZIP archive from another implementation") {
+  Decoco::ZipReader reader(pythonZip);
+  REQUIRE(reader.entries().size() == 2);
+  auto deflated = reader.find("hello.txt");
+  REQUIRE(deflated);
+  REQUIRE(deflated->method == 8);
+  REQUIRE(reader.read(*deflated) == join({ hello, hello, hello }));
+  auto stored = reader.find("dir/stored.bin");
+  REQUIRE(stored);
+  REQUIRE(reader.read(*stored) == hello);
+  // A stored entry is where it is in the archive.
+  auto raw = reader.raw(*stored);
+  REQUIRE(raw.data() == pythonZip.data() + 93);
+  REQUIRE(std::equal(raw.begin(), raw.end(), hello.begin(), hello.end()));
+  REQUIRE(!reader.find("hello"));
+
+  REQUIRE(Decoco::ZipReader(hello).entries().empty());
+  REQUIRE(Decoco::ZipReader(std::span<const uint8_t>(pythonZip).first(200)).entries().empty());
+  auto corrupt = pythonZip;
+  corrupt[45] ^= 1;
+  Decoco::ZipReader corruptReader(corrupt);
+  REQUIRE(corruptReader.entries().size() == 2);
+  REQUIRE(corruptReader.read(*corruptReader.find("hello.txt")).empty());
+}
+
+TEST_CASE("ZIP archives too short for the ZIP64 record they point to are rejected") {
+  // A ZIP64 locator that points at a ZIP64 end record signature in its own
+  // disk number field, and an empty end record: 42 bytes, less than a ZIP64
+  // end record.
+  std::vector<uint8_t> crafted = {
+    0x50, 0x4b, 0x06, 0x07, 0x50, 0x4b, 0x06, 0x06, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+    0x50, 0x4b, 0x05, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  };
+  REQUIRE(crafted.size() == 42);
+  REQUIRE(Decoco::ZipReader(crafted).entries().empty());
+}
+
+TEST_CASE("ZIP archives written on any number of threads read back the same") {
+  std::vector<std::pair<std::string, std::vector<uint8_t>>> files;
+  for (uint32_t n = 0; n < 200; n++) files.emplace_back("logs/" + std::to_string(n) + ".log", testText(n * 331, n));
+  files.emplace_back("noise.bin", testNoise(100000, 5));
+  files.emplace_back("caf\xc3\xa9.txt", hello);
+
+  std::vector<uint8_t> archives[3];
+  size_t threads[3] = { 1, 3, 0 };
+  for (size_t t = 0; t < 3; t++) {
+    Decoco::ZipWriter writer(Decoco::Compressor::Level::Fast, threads[t]);
+    std::vector<std::vector<uint8_t>> pieces;
+    for (auto& [name, data] : files) pieces.push_back(writer.add(name, data));
+    pieces.push_back(writer.add("stored.log", files[150].second, Decoco::ZipWriter::Method::Stored));
+    pieces.push_back(writer.finish());
+    archives[t] = join(pieces);
+  }
+  REQUIRE(archives[0] == archives[1]);
+  REQUIRE(archives[0] == archives[2]);
+
+  Decoco::ZipReader reader(archives[0]);
+  REQUIRE(reader.entries().size() == files.size() + 1);
+  for (auto& [name, data] : files) {
+    auto entry = reader.find(name);
+    REQUIRE(entry);
+    REQUIRE(reader.read(*entry) == data);
+  }
+  REQUIRE(reader.find("logs/0.log")->method == 0);
+  REQUIRE(reader.find("logs/1.log")->method == 8);
+  REQUIRE(reader.find("noise.bin")->method == 0);
+  REQUIRE(reader.find("caf\xc3\xa9.txt")->flags == 0x800);
+  auto stored = reader.find("stored.log");
+  REQUIRE(stored->method == 0);
+  std::vector<uint8_t> out(stored->size);
+  REQUIRE(reader.read(*stored, out));
+  REQUIRE(out == files[150].second);
+  REQUIRE(!reader.read(*stored, std::span<uint8_t>(out).first(10)));
+}
+
+TEST_CASE("ZIP archives with more than 65535 entries use ZIP64") {
+  Decoco::ZipWriter writer;
+  std::vector<std::vector<uint8_t>> pieces;
+  for (size_t n = 0; n < 70000; n++) pieces.push_back(writer.add(std::to_string(n), std::span<const uint8_t>(hello).first(n % 7)));
+  pieces.push_back(writer.finish());
+  auto archive = join(pieces);
+  // The ZIP64 end of central directory record and its locator come first.
+  REQUIRE(archive[archive.size() - 22 - 20 - 56] == 0x50);
+  REQUIRE(archive[archive.size() - 22 - 20 - 56 + 2] == 0x06);
+
+  Decoco::ZipReader reader(archive);
+  REQUIRE(reader.entries().size() == 70000);
+  REQUIRE(reader.read(*reader.find("69999")) == std::vector<uint8_t>(hello.begin(), hello.begin() + 69999 % 7));
+  REQUIRE(reader.read(*reader.find("0")).empty());
+}
+
+TEST_CASE("ZIP archive creation and extraction", "[!benchmark]") {
+  // Many small documents, as an export bundle holds them.
+  std::vector<std::vector<uint8_t>> files;
+  for (uint32_t n = 0; n < 20000; n++) files.push_back(testText(2000 + n % 7000, n));
+  auto create = [&](size_t threads) {
+    Decoco::ZipWriter writer(Decoco::Compressor::Level::Balanced, threads);
+    std::vector<std::vector<uint8_t>> pieces;
+    for (size_t n = 0; n < files.size(); n++) pieces.push_back(writer.add("doc" + std::to_string(n) + ".log", files[n]));
+    pieces.push_back(writer.finish());
+    return join(pieces);
+  };
+  auto archive = create(1);
+  BENCHMARK("Create") {
+    return create(1);
+  };
+  BENCHMARK("Create, all cores") {
+    return create(0);
+  };
+  BENCHMARK("Open") {
+    return Decoco::ZipReader(archive).entries().size();
+  };
+  Decoco::ZipReader reader(archive);
+  BENCHMARK("Extract all") {
+    size_t total = 0;
+    for (auto& entry : reader.entries()) total += reader.read(entry).size();
+    return total;
+  };
+}
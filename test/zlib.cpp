@@ -1,5 +1,8 @@
 #include <decoco/decoco.hpp>
 #include <catch2/catch_all.hpp>
+#include <bit>
+#include "test_data.h"
+#include "../src/zlib/zlib.h"
 
 static std::vector<uint8_t> hello = { 0x68, 0x65, 0x6c, 0x6c, 0x6f, 0x0a };
 
@@ -22,4 +25,127 @@ TEST_CASE("Basic zlib decompress of hello") {
   REQUIRE(unzippedData == hello);
 }
 
+TEST_CASE("Zlib trailer holds the Adler-32 of the input") {
+  // An odd length, so both the vectorized and the scalar Adler-32 run.
+  std::vector<uint8_t> data;
+  for (size_t n = 0; n < 100003; n++) data.push_back(uint8_t(n * n >> 7));
+  auto zlibData = Decoco::compress(Decoco::ZlibCompressor(), data);
+  std::vector<uint8_t> adler(zlibData.end() - 4, zlibData.end());
+  REQUIRE(adler == std::vector<uint8_t>{ 0xab, 0xa4, 0xa7, 0x12 });
+  REQUIRE(Decoco::decompress(Decoco::ZlibDecompressor(), zlibData) == data);
+}
+
+TEST_CASE("Parallel zlib roundtrip") {
+  std::vector<uint8_t> data;
+  for (size_t n = 0; n < 300000; n++) data.push_back(uint8_t(n * n >> 7));
+  auto compressed = Decoco::compress(Decoco::ZlibCompressor(Decoco::Compressor::Level::Fast, 16384, 3), data);
+  REQUIRE(Decoco::decompress(Decoco::ZlibDecompressor(), compressed) == data);
+}
 
+// Input for inflateBack(), handed out a piece at a time.
+struct BackInput {
+  std::span<const uint8_t> data;
+  size_t piece;
+};
+
+static uint64_t backIn(void* desc, const uint8_t** buf) {
+  auto& input = *static_cast<BackInput*>(desc);
+  size_t n = std::min(input.piece, input.data.size());
+  *buf = input.data.data();
+  input.data = input.data.subspan(n);
+  return n;
+}
+
+static int backOut(void* desc, uint8_t* buf, uint64_t len) {
+  auto& output = *static_cast<std::vector<uint8_t>*>(desc);
+  output.insert(output.end(), buf, buf + len);
+  return 0;
+}
+
+static std::vector<uint8_t> inflateThroughRing(std::span<const uint8_t> in, std::vector<uint8_t>& ring) {
+  Zlib::z_stream strm = {};
+  REQUIRE(Zlib::inflateBackInit(&strm, 15, ring.data()) == Zlib::Z_OK);
+  BackInput input{ in, 1000 };
+  std::vector<uint8_t> out;
+  REQUIRE(Zlib::inflateBack(&strm, backIn, &input, backOut, &out) == Zlib::Z_STREAM_END);
+  REQUIRE(Zlib::inflateBackEnd(&strm) == Zlib::Z_OK);
+  return out;
+}
+
+// Writes a single fixed Huffman block by hand, as zlib's deflate never matches
+// as far back as the whole 32 KiB window, and keeps the output it stands for.
+struct FixedBlock {
+  std::vector<uint8_t> bytes, output;
+  uint32_t bits = 0;
+  int count = 0;
+
+  // The block is the last one, after blocks that gave the output so far.
+  FixedBlock(std::vector<uint8_t> before = {}) : output(std::move(before)) { put(1, 1); put(1, 2); }
+  void put(uint32_t value, int n) {
+    bits |= value << count;
+    count += n;
+    for (; count >= 8; count -= 8, bits >>= 8) bytes.push_back(uint8_t(bits));
+  }
+  // Huffman codes go in from their top bit.
+  void putCode(uint32_t code, int n) {
+    while (n--) put((code >> n) & 1, 1);
+  }
+  void literal(uint8_t b) {
+    if (b < 144) putCode(0x30 + b, 8);
+    else putCode(0x190 + b - 144, 9);
+    output.push_back(b);
+  }
+  // Length is 258 or 3 to 10, which take no extra bits.
+  void match(unsigned length, unsigned distance) {
+    if (length == 258) putCode(0xc5, 8);
+    else putCode(length - 2, 7);
+    unsigned v = distance - 1;
+    if (v < 4) {
+      putCode(v, 5);
+    } else {
+      int extra = std::bit_width(v) - 2;
+      putCode(2 * extra + 2 + ((v >> extra) & 1), 5);
+      put(v & ((1u << extra) - 1), extra);
+    }
+    for (unsigned n = 0; n < length; n++) output.push_back(output[output.size() - distance]);
+  }
+  std::vector<uint8_t> finish() {
+    putCode(0, 7);
+    if (count) put(0, 8 - count);
+    return bytes;
+  }
+};
+
+TEST_CASE("Inflate through a caller's ring with inflateBack") {
+  std::vector<uint8_t> ring(Zlib::inflateBackWindowSize(15));
+
+  // A window of noise and then matches back to it from as far as deflate
+  // allows. A literal now and then moves where the matches start, so that
+  // they start all over the ring and many of them cross its end.
+  FixedBlock block;
+  for (uint8_t b : testNoise(32768, 777)) block.literal(b);
+  for (unsigned n = 0; n < 2000; n++) {
+    block.match(n % 5 ? 258 : 3 + n % 8, 32768 - n % 4 * 1000);
+    if (n % 7 == 0) block.literal(uint8_t(n));
+  }
+  auto far = block.finish();
+  REQUIRE(inflateThroughRing(far, ring) == block.output);
+
+  // A stored block of more than the ring holds, and then matches back into it.
+  auto noise = testNoise(60000, 778);
+  uint16_t len = uint16_t(noise.size());
+  std::vector<uint8_t> stored = { 0x00, uint8_t(len), uint8_t(len >> 8), uint8_t(~len), uint8_t(~len >> 8) };
+  stored.insert(stored.end(), noise.begin(), noise.end());
+  FixedBlock after(noise);
+  for (unsigned n = 0; n < 300; n++) after.match(258, 32768 - n % 3);
+  auto tail = after.finish();
+  stored.insert(stored.end(), tail.begin(), tail.end());
+  REQUIRE(inflateThroughRing(stored, ring) == after.output);
+
+  // The ring is reused from its start for a following stream.
+  REQUIRE(inflateThroughRing(far, ring) == block.output);
+
+  // And the same data decodes the same through inflate().
+  REQUIRE(Decoco::decompress(Decoco::DeflateDecompressor(), far) == block.output);
+  REQUIRE(Decoco::decompress(Decoco::DeflateDecompressor(), stored) == after.output);
+}
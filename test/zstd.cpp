@@ -20,3 +20,25 @@ TEST_CASE("Basic zstd of hello") {
 }
 
 
+
+TEST_CASE("One-shot zstd keeps the checksum") {
+  auto compressor = Decoco::ZstdCompressor();
+  std::vector<uint8_t> out(compressor->compressBound(hello.size()));
+  auto zstdData = compressor->compressInto(hello, out);
+  REQUIRE(zstdData.size() > 4);
+  // The checksum flag of the frame header descriptor.
+  REQUIRE((zstdData[4] & 4) != 0);
+  REQUIRE(Decoco::decompress(Decoco::ZstdDecompressor(), zstdData) == hello);
+  REQUIRE(compressor->compressInto(hello, std::span<uint8_t>(out).first(4)).empty());
+}
+
+TEST_CASE("Zstd frames give their content size") {
+  auto compressor = Decoco::ZstdCompressor();
+  auto oneShot = Decoco::compress(compressor, hello);
+  REQUIRE(Decoco::decompressedSizeHint(oneShot) == hello.size());
+  auto frames = oneShot;
+  frames.insert(frames.end(), oneShot.begin(), oneShot.end());
+  REQUIRE(Decoco::decompressedSizeHint(frames) == 2 * hello.size());
+  // A stream does not know its size when the frame header is written.
+  REQUIRE(Decoco::decompressedSizeHint(helloZstd) == 0);
+}